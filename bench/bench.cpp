@@ -0,0 +1,495 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <QApplication>
+#include <QCommandLineOption>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QLoggingCategory>
+#include <QProcess>
+#include <QStringList>
+#include <QTextStream>
+#include <QTimer>
+
+#include <sys/resource.h>
+
+#include "controller.h"
+#include "document.h"
+#include "render.h"
+#include "session.h"
+#include "views.h"
+
+/* Headless render benchmark.
+ *
+ * Drives the real render system with a scripted navigation.
+ * Requests come from the real views (PresentationView, PresenterView) shown in the offscreen
+ * platform, so render sizes follow the presenter layout for the selected screen size.
+ *
+ * For each configuration (prefetch strategy, cache size), reports:
+ * latency percentiles of requests (from request to pixmap),
+ * throughput (navigation steps per second, waiting for all requested pixmaps at each step),
+ * and peak memory usage (resident set size).
+ *
+ * Each configuration runs in a separate process (same executable, --run),
+ * so that they do not share caches, poppler state, or the peak memory measurement.
+ *
+ * Instead of a scripted navigation, a session recorded by pdftalk (--record-session) can be
+ * replayed with its real timing. Its requests are sent directly to the render system.
+ */
+
+// Pages visited by the navigation, in order
+static std::vector<int> make_navigation (const QString & name, int nb_pages, int nb_steps) {
+	std::vector<int> pages;
+	if (name == "forward") {
+		for (int i = 0; i < nb_pages; ++i) {
+			pages.push_back (i);
+		}
+	} else if (name == "backward") {
+		for (int i = nb_pages - 1; i >= 0; --i) {
+			pages.push_back (i);
+		}
+	} else if (name == "random") {
+		std::mt19937 generator (42); // Fixed seed: same navigation for all configurations
+		std::uniform_int_distribution<int> distribution (0, nb_pages - 1);
+		for (int i = 0; i < nb_steps; ++i) {
+			pages.push_back (distribution (generator));
+		}
+	}
+	return pages;
+}
+
+static qint64 peak_resident_memory_bytes () {
+	struct rusage usage;
+	if (getrusage (RUSAGE_SELF, &usage) != 0) {
+		return -1;
+	}
+#ifdef Q_OS_DARWIN
+	return usage.ru_maxrss; // bytes
+#else
+	return static_cast<qint64> (usage.ru_maxrss) * 1024; // kilobytes
+#endif
+}
+
+struct Configuration {
+	QString strategy;
+	qint64 cache_size_bytes;
+	int render_threads;
+	QSize screen_size;
+	int dwell_ms;
+	std::vector<int> navigation;
+	std::vector<SessionEvent> session; // Replaces navigation if not empty
+};
+
+static const char result_format[] = "%1 %2 %3 %4 %5 %6 %7 %8 %9\n";
+
+/* Prints the result line of a configuration.
+ * Requests are lost if unanswered before a timeout, or superseded by another request.
+ * Throughput is not relevant (< 0) when replaying a session with its timing.
+ */
+static void print_result (const Configuration & config, std::vector<qint64> latencies_ns,
+                          double throughput, int nb_lost) {
+	std::sort (latencies_ns.begin (), latencies_ns.end ());
+	auto percentile_ms = [&latencies_ns](int p) {
+		if (latencies_ns.empty ()) {
+			return QString ("-");
+		}
+		auto index = std::min (latencies_ns.size () - 1, latencies_ns.size () * p / 100);
+		return QString::number (latencies_ns[index] / 1e6, 'f', 1);
+	};
+	QTextStream (stdout) << QString (result_format)
+	                            .arg (config.strategy, -10)
+	                            .arg (size_in_bytes_to_string (config.cache_size_bytes), 6)
+	                            .arg (static_cast<int> (latencies_ns.size ()), 8)
+	                            .arg (percentile_ms (50), 8)
+	                            .arg (percentile_ms (95), 8)
+	                            .arg (percentile_ms (99), 8)
+	                            .arg (throughput >= 0 ? QString::number (throughput, 'f', 1)
+	                                                  : QString ("-"),
+	                                  8)
+	                            .arg (QString::number (peak_resident_memory_bytes () >> 20) + 'M', 8)
+	                            .arg (nb_lost, 8);
+}
+
+// The render system ignores null and tiny renders (hidden views)
+static bool will_be_answered (const Render::Info & render_info) {
+	static constexpr int min_size_px = 10;
+	return !render_info.isNull () && render_info.size ().width () >= min_size_px &&
+	       render_info.size ().height () >= min_size_px;
+}
+
+static bool make_render_options (const Configuration & config, Render::Options & render_options) {
+	render_options.codec = Render::default_codec ();
+	render_options.strategy = Render::select_prefetch_strategy_by_name (config.strategy);
+	if (render_options.strategy == nullptr && config.strategy != "none") {
+		QTextStream (stderr) << "Error: unknown prefetch strategy: " << config.strategy << "\n";
+		return false;
+	}
+	render_options.cache_size_bytes = config.cache_size_bytes;
+	render_options.render_threads = config.render_threads;
+	return true;
+}
+
+/* Runs one configuration, with its own render system and views.
+ * Prints one result line on stdout, returns the exit code.
+ */
+static int run_navigation (QApplication & app, const Document & document,
+                           const Configuration & config) {
+	Render::Options render_options;
+	if (!make_render_options (config, render_options)) {
+		return EXIT_FAILURE;
+	}
+
+	// Same components as pdftalk, without the windowing and shortcuts
+	std::unique_ptr<PresentationView> presentation_view (new PresentationView);
+	std::unique_ptr<PresenterView> presenter_view (new PresenterView (document.nb_slides ()));
+	Controller control (document, *presenter_view);
+	Render::System renderer (render_options);
+
+	QObject::connect (&control, &Controller::current_page_changed, presenter_view.get (),
+	                  &PresenterView::change_slide_info);
+
+	// Latency measurement: requests pending for each role.
+	// Connected before the render system, which may answer during the request.
+	struct PendingRequest {
+		Render::Info render_info;
+		qint64 start_ns;
+	};
+	QHash<ViewRole, PendingRequest> pending_requests;
+	std::vector<qint64> latencies_ns;
+	QElapsedTimer clock;
+	clock.start ();
+
+	auto viewers =
+	    std::initializer_list<PageViewer *>{presentation_view.get (),
+	                                        presenter_view->current_page_viewer (),
+	                                        presenter_view->next_slide_first_page_viewer (),
+	                                        presenter_view->next_transition_page_viewer (),
+	                                        presenter_view->previous_transition_page_viewer ()};
+	for (auto v : viewers) {
+		QObject::connect (v, &PageViewer::request_render, [&](const Render::Request & request) {
+			auto render_info = request.requested_render ();
+			if (will_be_answered (render_info)) {
+				pending_requests.insert (request.role (),
+				                         PendingRequest{render_info, clock.nsecsElapsed ()});
+			}
+		});
+		QObject::connect (&control, &Controller::current_page_changed, v,
+		                  &PageViewer::change_current_page);
+		QObject::connect (v, &PageViewer::request_render, &renderer, &Render::System::request_render);
+		QObject::connect (&renderer, &Render::System::new_render, v, &PageViewer::receive_pixmap);
+	}
+
+	// Navigation: each step waits for all requested pixmaps, then dwells.
+	static constexpr qint64 step_timeout_ns = Q_INT64_C (60000000000); // 60s
+	std::size_t next_step = 0;
+	bool step_in_progress = false;
+	qint64 step_start_ns = 0;
+	int nb_lost = 0;
+	std::function<void()> start_step;
+	auto check_step_done = [&]() {
+		if (!step_in_progress) {
+			return;
+		}
+		if (pending_requests.isEmpty () || clock.nsecsElapsed () - step_start_ns > step_timeout_ns) {
+			nb_lost += pending_requests.size ();
+			pending_requests.clear ();
+			step_in_progress = false;
+			if (next_step < config.navigation.size ()) {
+				QTimer::singleShot (config.dwell_ms, start_step);
+			} else {
+				app.quit ();
+			}
+		}
+	};
+	start_step = [&]() {
+		// Some requests may be answered immediately: only check completion after all views
+		step_start_ns = clock.nsecsElapsed ();
+		control.go_to_page_index (config.navigation[next_step++]);
+		step_in_progress = true;
+		check_step_done ();
+	};
+	auto on_new_render = [&](const Render::Info & render_info) {
+		auto it = pending_requests.begin ();
+		while (it != pending_requests.end ()) {
+			if (it.value ().render_info == render_info) {
+				latencies_ns.push_back (clock.nsecsElapsed () - it.value ().start_ns);
+				it = pending_requests.erase (it);
+			} else {
+				++it;
+			}
+		}
+		check_step_done ();
+	};
+	QObject::connect (&renderer, &Render::System::new_render, on_new_render);
+	QTimer step_timeout_timer;
+	QObject::connect (&step_timeout_timer, &QTimer::timeout, check_step_done);
+	step_timeout_timer.start (1000);
+
+	// Show views to let layouts settle, then start from the first page
+	presentation_view->resize (config.screen_size);
+	presenter_view->resize (config.screen_size);
+	presentation_view->show ();
+	presenter_view->show ();
+	app.processEvents ();
+	control.bootstrap ();
+	pending_requests.clear (); // Not measured: first page requests
+	QElapsedTimer wall_clock;
+	wall_clock.start ();
+	QTimer::singleShot (0, start_step);
+	app.exec ();
+	const qint64 wall_ns = wall_clock.nsecsElapsed ();
+
+	const double idle_s = config.dwell_ms * 1e-3 * config.navigation.size ();
+	const double busy_s = std::max (wall_ns * 1e-9 - idle_s, 1e-9);
+	print_result (config, latencies_ns, config.navigation.size () / busy_s, nb_lost);
+	return EXIT_SUCCESS;
+}
+
+/* Replays a recorded session, sending its requests to the render system at their recorded time.
+ * Views are not needed, as recorded requests already contain the render sizes.
+ * Prints one result line on stdout, returns the exit code.
+ */
+static int run_session_replay (QApplication & app, const Document & document,
+                               const Configuration & config) {
+	Render::Options render_options;
+	if (!make_render_options (config, render_options)) {
+		return EXIT_FAILURE;
+	}
+	Render::System renderer (render_options);
+
+	struct PendingRequest {
+		Render::Info render_info;
+		qint64 start_ns;
+	};
+	QHash<ViewRole, PendingRequest> pending_requests;
+	std::vector<qint64> latencies_ns;
+	int nb_lost = 0;
+	QElapsedTimer clock;
+
+	QObject::connect (&renderer, &Render::System::new_render, [&](const Render::Info & render_info) {
+		auto it = pending_requests.begin ();
+		while (it != pending_requests.end ()) {
+			if (it.value ().render_info == render_info) {
+				latencies_ns.push_back (clock.nsecsElapsed () - it.value ().start_ns);
+				it = pending_requests.erase (it);
+			} else {
+				++it;
+			}
+		}
+	});
+
+	// Send each event at its time, then wait for the last renders (or timeout)
+	static constexpr int drain_timeout_ms = 60000;
+	std::size_t next_event = 0;
+	QTimer event_timer;
+	event_timer.setSingleShot (true);
+	std::function<void()> send_events = [&]() {
+		while (next_event < config.session.size () &&
+		       config.session[next_event].time_ms <= clock.elapsed ()) {
+			const auto & event = config.session[next_event++];
+			Render::Request request (document.page (event.current_page_index), event.box, event.role,
+			                         event.cause);
+			if (pending_requests.remove (event.role) > 0) {
+				nb_lost++; // Superseded
+			}
+			auto render_info = request.requested_render ();
+			if (will_be_answered (render_info)) {
+				pending_requests.insert (event.role,
+				                         PendingRequest{render_info, clock.nsecsElapsed ()});
+			}
+			renderer.request_render (request);
+		}
+		if (next_event < config.session.size ()) {
+			const auto delay_ms = config.session[next_event].time_ms - clock.elapsed ();
+			event_timer.start (static_cast<int> (std::max<qint64> (delay_ms, 0)));
+		}
+	};
+	QObject::connect (&event_timer, &QTimer::timeout, send_events);
+	QTimer drain_timer;
+	QObject::connect (&drain_timer, &QTimer::timeout, [&]() {
+		const bool drain_timed_out =
+		    clock.elapsed () > config.session.back ().time_ms + drain_timeout_ms;
+		if (next_event == config.session.size () && (pending_requests.isEmpty () || drain_timed_out)) {
+			nb_lost += pending_requests.size ();
+			app.quit ();
+		}
+	});
+	drain_timer.start (10);
+
+	clock.start ();
+	QTimer::singleShot (0, send_events);
+	app.exec ();
+
+	print_result (config, latencies_ns, -1, nb_lost);
+	return EXIT_SUCCESS;
+}
+
+int main (int argc, char * argv[]) {
+	// No display needed
+	if (qEnvironmentVariableIsEmpty ("QT_QPA_PLATFORM")) {
+		qputenv ("QT_QPA_PLATFORM", "offscreen");
+	}
+	QApplication app (argc, argv);
+	QCoreApplication::setApplicationName ("pdftalk-bench");
+
+	qRegisterMetaType<Render::Info> ();
+	qRegisterMetaType<Render::Request> ();
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription (
+	    "PDFTalk render benchmark.\n"
+	    "Replays a navigation in a PDF document with each configuration of the render system.\n"
+	    "Measures request latency (ms), throughput (navigation steps/s), peak memory.");
+	parser.addHelpOption ();
+	parser.addPositionalArgument ("file.pdf", "PDF file to open");
+	QCommandLineOption strategies_option (
+	    "strategies",
+	    QString ("Prefetch strategies to compare (default = all; %1, none)")
+	        .arg (Render::list_of_prefetch_strategy_names ().join (',')),
+	    "names");
+	parser.addOption (strategies_option);
+	QCommandLineOption cache_sizes_option (
+	    "cache-sizes", "Render cache sizes to compare (default = 10M,50M,200M)", "sizes",
+	    "10M,50M,200M");
+	parser.addOption (cache_sizes_option);
+	QCommandLineOption navigation_option (
+	    "navigation", "Navigation: forward, backward, random (default = forward)", "name",
+	    "forward");
+	parser.addOption (navigation_option);
+	QCommandLineOption steps_option ("steps", "Number of steps of random navigation", "n");
+	parser.addOption (steps_option);
+	QCommandLineOption dwell_option ("dwell", "Time spent on each page (default = 0)", "ms", "0");
+	parser.addOption (dwell_option);
+	QCommandLineOption screen_option ("screen", "Screen size (default = 1920x1080)", "WxH",
+	                                  "1920x1080");
+	parser.addOption (screen_option);
+	QCommandLineOption render_threads_option (
+	    "render-threads", "Number of render threads (default = one per core)", "n", "0");
+	parser.addOption (render_threads_option);
+	QCommandLineOption session_option (
+	    "session", "Replay a session recorded with pdftalk --record-session, instead of navigation",
+	    "file");
+	parser.addOption (session_option);
+	QCommandLineOption run_option ("run", "Internal: run a single configuration", "strategy:size");
+	run_option.setFlags (QCommandLineOption::HiddenFromHelp);
+	parser.addOption (run_option);
+	parser.process (app);
+
+	auto arguments = parser.positionalArguments ();
+	if (arguments.size () != 1) {
+		parser.showHelp (EXIT_FAILURE);
+	}
+	const QString filename = arguments[0];
+
+	if (parser.isSet (run_option)) {
+		// Child process: single configuration. Render system traces would flood the output.
+		QLoggingCategory::setFilterRules ("*.debug=false");
+		auto document = Document::open (filename, filename + "pc");
+		if (!document) {
+			return EXIT_FAILURE;
+		}
+		const auto run = parser.value (run_option).split (':');
+		const auto screen = parser.value (screen_option).split ('x');
+		if (run.size () != 2 || screen.size () != 2) {
+			return EXIT_FAILURE;
+		}
+		Configuration config;
+		config.strategy = run[0];
+		config.cache_size_bytes = string_to_size_in_bytes (run[1]);
+		config.render_threads = parser.value (render_threads_option).toInt ();
+		config.screen_size = QSize (screen[0].toInt (), screen[1].toInt ());
+		config.dwell_ms = parser.value (dwell_option).toInt ();
+		const int nb_steps = parser.isSet (steps_option) ? parser.value (steps_option).toInt ()
+		                                                 : 2 * document->nb_pages ();
+		config.navigation =
+		    make_navigation (parser.value (navigation_option), document->nb_pages (), nb_steps);
+		if (parser.isSet (session_option) &&
+		    !read_session (parser.value (session_option), *document, config.session)) {
+			return EXIT_FAILURE;
+		}
+		if (config.cache_size_bytes < 0 || config.screen_size.isEmpty () ||
+		    (config.navigation.empty () && config.session.empty ())) {
+			QTextStream (stderr) << "Error: invalid configuration\n";
+			return EXIT_FAILURE;
+		}
+		if (!config.session.empty ()) {
+			return run_session_replay (app, *document, config);
+		}
+		return run_navigation (app, *document, config);
+	}
+
+	// Parent process: run each configuration in a child process
+	QStringList strategies = Render::list_of_prefetch_strategy_names ();
+	if (parser.isSet (strategies_option)) {
+		strategies = parser.value (strategies_option).split (',');
+	}
+	const auto cache_sizes = parser.value (cache_sizes_option).split (',');
+
+	QStringList common_arguments{filename,
+	                             "--navigation",
+	                             parser.value (navigation_option),
+	                             "--dwell",
+	                             parser.value (dwell_option),
+	                             "--screen",
+	                             parser.value (screen_option),
+	                             "--render-threads",
+	                             parser.value (render_threads_option)};
+	if (parser.isSet (steps_option)) {
+		common_arguments << "--steps" << parser.value (steps_option);
+	}
+	if (parser.isSet (session_option)) {
+		common_arguments << "--session" << parser.value (session_option);
+	}
+
+	QTextStream out (stdout);
+	out << QString (result_format)
+	           .arg ("strategy", -10)
+	           .arg ("cache", 6)
+	           .arg ("requests", 8)
+	           .arg ("p50 ms", 8)
+	           .arg ("p95 ms", 8)
+	           .arg ("p99 ms", 8)
+	           .arg ("steps/s", 8)
+	           .arg ("peak rss", 8)
+	           .arg ("lost", 8);
+	out.flush ();
+	int status = EXIT_SUCCESS;
+	for (const auto & strategy : strategies) {
+		for (const auto & cache_size : cache_sizes) {
+			QProcess child;
+			child.setProcessChannelMode (QProcess::ForwardedErrorChannel);
+			child.start (QCoreApplication::applicationFilePath (),
+			             QStringList (common_arguments)
+			                 << "--run" << QString ("%1:%2").arg (strategy.trimmed (), cache_size));
+			if (!child.waitForFinished (-1) || child.exitCode () != EXIT_SUCCESS) {
+				QTextStream (stderr) << "Error: configuration " << strategy << ":" << cache_size
+				                     << " failed\n";
+				status = EXIT_FAILURE;
+				continue;
+			}
+			out << child.readAllStandardOutput ();
+			out.flush ();
+		}
+	}
+	return status;
+}
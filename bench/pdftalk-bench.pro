@@ -0,0 +1,8 @@
+### Headless render benchmark (see bench.cpp) ###
+# Build: cd bench && qmake && make
+
+TEMPLATE = app
+TARGET = pdftalk-bench
+
+include(../pdftalk.pri)
+SOURCES += $$PWD/bench.cpp
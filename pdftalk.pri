@@ -0,0 +1,53 @@
+### Sources shared by pdftalk and pdftalk-bench (bench/) ###
+
+CONFIG += c++11
+
+INCLUDEPATH += $$PWD/src/
+CONFIG(release, debug|release): DEFINES += QT_NO_DEBUG_OUTPUT
+
+QT += core widgets
+HEADERS += \
+	$$PWD/src/action.h \
+	$$PWD/src/controller.h \
+	$$PWD/src/document.h \
+	$$PWD/src/memory.h \
+	$$PWD/src/render.h \
+	$$PWD/src/render_internal.h \
+	$$PWD/src/session.h \
+	$$PWD/src/trace.h \
+	$$PWD/src/utils.h \
+	$$PWD/src/views.h \
+	$$PWD/src/window.h
+SOURCES += \
+	$$PWD/src/action.cpp \
+	$$PWD/src/buffer_pool.cpp \
+	$$PWD/src/codecs.cpp \
+	$$PWD/src/controller.cpp \
+	$$PWD/src/disk_cache.cpp \
+	$$PWD/src/document.cpp \
+	$$PWD/src/memory.cpp \
+	$$PWD/src/prefetch_strategies.cpp \
+	$$PWD/src/render.cpp \
+	$$PWD/src/render_cache.cpp \
+	$$PWD/src/scheduler.cpp \
+	$$PWD/src/session.cpp \
+	$$PWD/src/statistics.cpp \
+	$$PWD/src/trace.cpp \
+	$$PWD/src/views.cpp
+
+# Poppler
+macx: { # Mac
+	# Stack overflow : pkg config disabled by default on mac...
+	QT_CONFIG -= no-pkg-config
+}
+CONFIG += link_pkgconfig
+PKGCONFIG += poppler-qt5
+
+# LZ4 (optional, fast render cache codec)
+packagesExist(liblz4) {
+	PKGCONFIG += liblz4
+	DEFINES += PDFTALK_HAVE_LZ4
+}
+
+VERSION = 1.1
+DEFINES += PDFTALK_VERSION=$${VERSION}
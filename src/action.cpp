@@ -19,6 +19,7 @@
 
 #include "action.h"
 #include "controller.h"
+#include "document.h"
 
 namespace Action {
 void Quit::execute (Controller &) const {
@@ -42,4 +43,24 @@ void PageLast::execute (Controller & controller) const {
 void PageIndex::execute (Controller & controller) const {
 	controller.go_to_page_index (index_);
 }
+
+// Navigation targets
+static int valid_page_index_or_none (const PageInfo & current_page, int index) {
+	return 0 <= index && index < current_page.document ().nb_pages () ? index : -1;
+}
+int PageNext::target_page_index (const PageInfo & current_page) const {
+	return valid_page_index_or_none (current_page, current_page.index () + 1);
+}
+int PagePrevious::target_page_index (const PageInfo & current_page) const {
+	return valid_page_index_or_none (current_page, current_page.index () - 1);
+}
+int PageFirst::target_page_index (const PageInfo & current_page) const {
+	return valid_page_index_or_none (current_page, 0);
+}
+int PageLast::target_page_index (const PageInfo & current_page) const {
+	return valid_page_index_or_none (current_page, current_page.document ().nb_pages () - 1);
+}
+int PageIndex::target_page_index (const PageInfo & current_page) const {
+	return valid_page_index_or_none (current_page, index_);
+}
 } // namespace Action
@@ -20,6 +20,7 @@
 #include <QString>
 
 class Controller;
+class PageInfo;
 
 namespace Action {
 /* All clickable actions derive from Base.
@@ -28,6 +29,9 @@ namespace Action {
  *
  * Actions will always use the Controller API to change the presentation status.
  *
+ * Navigation actions also give the page index they will go to, to prefetch it.
+ * target_page_index is relative to the current page of the presentation, -1 if none.
+ *
  * Actions are extracted from the document in document.cpp.
  */
 class Base {
@@ -36,6 +40,7 @@ private:
 public:
 	virtual ~Base () = default;
 	virtual void execute (Controller & controller) const = 0;
+	virtual int target_page_index (const PageInfo &) const { return -1; }
 
 	void set_rect (const QRectF & rect) { rect_ = rect; }
 	bool activated (const QPointF & point) const { return rect_.contains (point); }
@@ -61,18 +66,22 @@ public:
 class PageNext : public Base {
 public:
 	void execute (Controller & controller) const Q_DECL_FINAL;
+	int target_page_index (const PageInfo & current_page) const Q_DECL_FINAL;
 };
 class PagePrevious : public Base {
 public:
 	void execute (Controller & controller) const Q_DECL_FINAL;
+	int target_page_index (const PageInfo & current_page) const Q_DECL_FINAL;
 };
 class PageFirst : public Base {
 public:
 	void execute (Controller & controller) const Q_DECL_FINAL;
+	int target_page_index (const PageInfo & current_page) const Q_DECL_FINAL;
 };
 class PageLast : public Base {
 public:
 	void execute (Controller & controller) const Q_DECL_FINAL;
+	int target_page_index (const PageInfo & current_page) const Q_DECL_FINAL;
 };
 class PageIndex : public Base {
 private:
@@ -81,5 +90,6 @@ private:
 public:
 	PageIndex (int index) : index_ (index) {}
 	void execute (Controller & controller) const Q_DECL_FINAL;
+	int target_page_index (const PageInfo & current_page) const Q_DECL_FINAL;
 };
 } // namespace Action
@@ -0,0 +1,148 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstdlib>
+
+#include <QMutexLocker>
+
+#include "render_internal.h"
+
+namespace Render {
+
+/* Buffers are allocated with a header storing their capacity, just before the returned pointer.
+ * The header size keeps the malloc alignment of pixels, which SIMD image routines benefit from.
+ */
+namespace {
+	constexpr qint64 header_bytes = 64;
+
+	qint64 & capacity_of (uchar * buffer) {
+		return *reinterpret_cast<qint64 *> (buffer - header_bytes);
+	}
+} // namespace
+
+BufferPool::BufferPool (qint64 max_free_bytes) : max_free_bytes_ (max_free_bytes) {}
+
+BufferPool::~BufferPool () {
+	trim ();
+}
+
+BufferPool & BufferPool::instance () {
+	// Holds a few 4K renders per view. Images may outlive the render system.
+	static BufferPool pool (qint64 (128) << 20);
+	return pool;
+}
+
+uchar * BufferPool::acquire (qint64 size) {
+	// Capacity is the smallest size class above size
+	// Copy the member: std::max takes references, and it has no out-of-class definition
+	size = std::max (size, qint64 (min_buffer_bytes));
+	qint64 power_of_two = min_buffer_bytes;
+	while (2 * power_of_two < size) {
+		power_of_two *= 2;
+	}
+	const qint64 step = power_of_two / classes_per_power_of_two;
+	const qint64 capacity = power_of_two + ((size - power_of_two + step - 1) / step) * step;
+	{
+		QMutexLocker lock (&mutex_);
+		counters_.acquired++;
+		auto it = free_buffers_.find (capacity);
+		if (it != free_buffers_.end () && !it.value ().isEmpty ()) {
+			auto * buffer = it.value ().takeLast ();
+			counters_.reused++;
+			counters_.free_bytes -= capacity;
+			return buffer;
+		}
+	}
+	auto * allocation = static_cast<uchar *> (std::malloc (header_bytes + capacity));
+	if (allocation == nullptr) {
+		return nullptr;
+	}
+	auto * buffer = allocation + header_bytes;
+	capacity_of (buffer) = capacity;
+	QMutexLocker lock (&mutex_);
+	counters_.allocated_bytes += capacity;
+	return buffer;
+}
+
+void BufferPool::release (uchar * buffer) {
+	if (buffer == nullptr) {
+		return;
+	}
+	const qint64 capacity = capacity_of (buffer);
+	{
+		QMutexLocker lock (&mutex_);
+		if (counters_.free_bytes + capacity <= max_free_bytes_) {
+			free_buffers_[capacity].append (buffer);
+			counters_.free_bytes += capacity;
+			return;
+		}
+		counters_.allocated_bytes -= capacity;
+	}
+	std::free (buffer - header_bytes);
+}
+
+void BufferPool::trim () {
+	QHash<qint64, QVector<uchar *>> to_free;
+	{
+		QMutexLocker lock (&mutex_);
+		to_free.swap (free_buffers_);
+		counters_.allocated_bytes -= counters_.free_bytes;
+		counters_.free_bytes = 0;
+	}
+	for (const auto & buffers : to_free) {
+		for (auto * buffer : buffers) {
+			std::free (buffer - header_bytes);
+		}
+	}
+}
+
+BufferPool::Counters BufferPool::counters () const {
+	QMutexLocker lock (&mutex_);
+	return counters_;
+}
+
+// Pooled images
+
+static void pooled_buffer_cleanup (void * buffer) {
+	BufferPool::instance ().release (static_cast<uchar *> (buffer));
+}
+
+QImage make_pooled_image (const QSize & size, QImage::Format format) {
+	// Same line alignment (32 bits) as the QImage constructor.
+	// Depth from a minimal image, as QImage::toPixelFormat requires Qt 5.4.
+	const int bits_per_line = size.width () * QImage (1, 1, format).depth ();
+	return make_pooled_image (size, ((bits_per_line + 31) / 32) * 4, format);
+}
+
+QImage make_pooled_image (const QSize & size, int bytes_per_line, QImage::Format format) {
+	if (size.isEmpty () || bytes_per_line <= 0) {
+		return QImage ();
+	}
+	auto * buffer = BufferPool::instance ().acquire (qint64 (bytes_per_line) * size.height ());
+	if (buffer == nullptr) {
+		return QImage ();
+	}
+	QImage image (buffer, size.width (), size.height (), bytes_per_line, format,
+	              &pooled_buffer_cleanup, buffer);
+	if (image.isNull ()) {
+		// The cleanup function is not called if the image could not be created
+		BufferPool::instance ().release (buffer);
+	}
+	return image;
+}
+
+} // namespace Render
@@ -0,0 +1,164 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstring>
+
+#ifdef PDFTALK_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "render_internal.h"
+
+namespace Render {
+
+Codec::Codec (const QString & name) : name_ (name) {}
+
+// Store the pixels as is: no cpu cost, maximum memory usage
+class RawCodec : public Codec {
+public:
+	RawCodec () : Codec ("raw") {}
+
+	QByteArray compress (const uchar * data, int size) const final {
+		return QByteArray (reinterpret_cast<const char *> (data), size);
+	}
+	bool uncompress (const QByteArray & data, uchar * output, int size) const final {
+		if (data.size () != size) {
+			return false;
+		}
+		std::memcpy (output, data.constData (), size);
+		return true;
+	}
+	bool data_is_pixels () const final { return true; }
+};
+
+// Qt zlib wrapper: good compression ratio, slow
+class ZlibCodec : public Codec {
+public:
+	ZlibCodec () : Codec ("zlib") {}
+
+	QByteArray compress (const uchar * data, int size) const final { return qCompress (data, size); }
+	bool uncompress (const QByteArray & data, uchar * output, int size) const final {
+		// qUncompress has no variant writing to a given buffer
+		auto uncompressed = qUncompress (data);
+		if (uncompressed.size () != size) {
+			return false;
+		}
+		std::memcpy (output, uncompressed.constData (), size);
+		return true;
+	}
+};
+
+#ifdef PDFTALK_HAVE_LZ4
+// LZ4: lower compression ratio than zlib, but decompression is an order of magnitude faster
+class Lz4Codec : public Codec {
+public:
+	Lz4Codec () : Codec ("lz4") {}
+
+	QByteArray compress (const uchar * data, int size) const final {
+		// Compress to a worst case sized pool buffer, and only copy the result to the cache
+		const int bound = LZ4_compressBound (size);
+		PooledBuffer compressed (BufferPool::instance ().acquire (bound));
+		if (compressed == nullptr) {
+			return QByteArray ();
+		}
+		auto * compressed_data = reinterpret_cast<char *> (compressed.get ());
+		int compressed_size =
+		    LZ4_compress_default (reinterpret_cast<const char *> (data), compressed_data, size, bound);
+		if (compressed_size <= 0) {
+			return QByteArray ();
+		}
+		return QByteArray (compressed_data, compressed_size);
+	}
+	bool uncompress (const QByteArray & data, uchar * output, int size) const final {
+		return LZ4_decompress_safe (data.constData (), reinterpret_cast<char *> (output),
+		                            data.size (), size) == size;
+	}
+};
+#endif
+
+/* Listing and selection.
+ * Same system as prefetch strategies: global stateless instances.
+ * Codecs are used concurrently by render threads, hence the const methods.
+ */
+namespace {
+	RawCodec raw;
+	ZlibCodec zlib;
+#ifdef PDFTALK_HAVE_LZ4
+	Lz4Codec lz4;
+#endif
+
+	const Codec * defined_codecs[] = {
+	    &raw, &zlib,
+#ifdef PDFTALK_HAVE_LZ4
+	    &lz4,
+#endif
+	};
+} // namespace
+
+QStringList list_of_codec_names () {
+	QStringList names;
+	for (const auto * codec : defined_codecs) {
+		names << codec->name ();
+	}
+	return names;
+}
+
+const Codec * default_codec () {
+#ifdef PDFTALK_HAVE_LZ4
+	return &lz4;
+#else
+	return &zlib;
+#endif
+}
+const Codec * select_codec_by_name (const QString & name) {
+	for (const auto * codec : defined_codecs) {
+		if (codec->name () == name.trimmed ()) {
+			return codec;
+		}
+	}
+	return nullptr;
+}
+
+// Storage formats
+
+static const struct {
+	const char * name;
+	StorageFormat format;
+} storage_formats[] = {
+    {"full", StorageFormat::Full},
+    {"auto", StorageFormat::Auto},
+    {"lossy", StorageFormat::Lossy},
+};
+
+QStringList list_of_storage_format_names () {
+	QStringList names;
+	for (const auto & entry : storage_formats) {
+		names << entry.name;
+	}
+	return names;
+}
+
+bool select_storage_format_by_name (const QString & name, StorageFormat & format) {
+	for (const auto & entry : storage_formats) {
+		if (name.trimmed () == entry.name) {
+			format = entry.format;
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace Render
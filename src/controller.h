@@ -19,6 +19,7 @@
 #include <QBasicTimer>
 #include <QDebug>
 #include <QElapsedTimer>
+#include <QHash>
 #include <QPixmap>
 #include <QTime>
 #include <vector>
@@ -45,6 +46,9 @@ enum class ViewRole {
 	Unknown
 };
 QDebug operator<< (QDebug d, ViewRole role);
+inline uint qHash (ViewRole role, uint seed = 0) {
+	return ::qHash (static_cast<int> (role), seed);
+}
 
 /* Page to show in the given role for the given current page.
  * nullptr indicates no page.
@@ -0,0 +1,184 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <vector>
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QtDebug>
+
+#include "document.h"
+#include "render_internal.h"
+
+namespace Render {
+
+/* File format: QDataStream of
+ * magic, format version, codec name, width, height, bytes per line, image format, colour table,
+ * data.
+ *
+ * The format version must be incremented if the file layout or the rendering options change.
+ * Old entries will then be ignored and overwritten.
+ */
+static constexpr quint32 file_magic = 0x50544b43; // "PTKC"
+static constexpr quint32 file_version = 2;
+
+DiskCache::DiskCache (const QString & directory, qint64 max_total_bytes)
+    : directory_ (directory), max_total_bytes_ (max_total_bytes) {
+	if (!QDir ().mkpath (directory_)) {
+		qDebug () << "disk cache: unable to create" << directory_;
+	}
+	prune ();
+}
+
+void DiskCache::prune () {
+	// Entries of all documents, identified by their name (other files are left as is)
+	struct Entry {
+		QString path;
+		qint64 size;
+		QDateTime modified;
+	};
+	static const QRegularExpression entry_name ("^p\\d+-\\d+x\\d+$");
+	const QString root = QFileInfo (directory_).absolutePath ();
+	std::vector<Entry> entries;
+	qint64 total_bytes = 0;
+	QDirIterator it (root, QDir::Files, QDirIterator::Subdirectories);
+	while (it.hasNext ()) {
+		it.next ();
+		const auto info = it.fileInfo ();
+		if (entry_name.match (info.fileName ()).hasMatch ()) {
+			entries.push_back (Entry{info.filePath (), info.size (), info.lastModified ()});
+			total_bytes += info.size ();
+		}
+	}
+
+	// Remove the least recently written entries, keeping room for the renders of this run
+	const qint64 target_bytes = max_total_bytes_ / 4 * 3;
+	if (total_bytes > target_bytes) {
+		std::sort (entries.begin (), entries.end (), [](const Entry & lhs, const Entry & rhs) {
+			return lhs.modified < rhs.modified;
+		});
+		QSet<QString> pruned_directories;
+		for (const auto & entry : entries) {
+			if (total_bytes <= target_bytes) {
+				break;
+			}
+			if (QFile::remove (entry.path)) {
+				total_bytes -= entry.size;
+				pruned_directories.insert (QFileInfo (entry.path).absolutePath ());
+			}
+		}
+		pruned_directories.remove (QFileInfo (directory_).absoluteFilePath ());
+		for (const auto & directory : pruned_directories) {
+			QDir ().rmdir (directory); // Only if empty
+		}
+		qDebug () << "disk cache: pruned to" << size_in_bytes_to_string (total_bytes);
+	}
+	total_bytes_.store (total_bytes);
+}
+
+QString DiskCache::entry_path (const Info & render_info) const {
+	return QString ("%1/p%2-%3x%4")
+	    .arg (directory_)
+	    .arg (render_info.page ()->index ())
+	    .arg (render_info.size ().width ())
+	    .arg (render_info.size ().height ());
+}
+
+bool DiskCache::contains (const Info & render_info) const {
+	return QFile::exists (entry_path (render_info));
+}
+
+bool DiskCache::load (const Info & render_info, Compressed & compressed) const {
+	Trace::Scope trace ("disk_load", trace_args (render_info));
+	QFile file (entry_path (render_info));
+	if (!file.open (QFile::ReadOnly)) {
+		return false;
+	}
+	QDataStream stream (&file);
+	quint32 magic = 0;
+	quint32 version = 0;
+	stream >> magic >> version;
+	if (stream.status () != QDataStream::Ok || magic != file_magic || version != file_version) {
+		return false;
+	}
+	QString codec_name;
+	qint32 width = 0;
+	qint32 height = 0;
+	qint32 bytes_per_line = 0;
+	qint32 image_format = 0;
+	QVector<QRgb> color_table;
+	QByteArray data;
+	stream >> codec_name >> width >> height >> bytes_per_line >> image_format >> color_table >>
+	    data;
+	if (stream.status () != QDataStream::Ok) {
+		return false;
+	}
+
+	// Validate entry
+	const auto * codec = select_codec_by_name (codec_name);
+	if (codec == nullptr) {
+		qDebug () << "disk cache: codec not available" << codec_name;
+		return false;
+	}
+	if (QSize (width, height) != render_info.size () || bytes_per_line <= 0 ||
+	    image_format <= QImage::Format_Invalid || image_format >= QImage::NImageFormats) {
+		return false;
+	}
+	if ((image_format == QImage::Format_Indexed8) != !color_table.isEmpty () ||
+	    color_table.size () > 256) {
+		return false;
+	}
+
+	compressed = Compressed{data, QSize (width, height), bytes_per_line,
+	                        static_cast<QImage::Format> (image_format), codec, color_table, 0,
+	                        Info (), 0};
+	return true;
+}
+
+void DiskCache::store (const Info & render_info, const Compressed & compressed) const {
+	Q_ASSERT (compressed.reference.isNull ());
+	Trace::Scope trace ("disk_store", trace_args (render_info));
+	// Header size is negligible. Replaced entries are counted twice, until the next prune.
+	const qint64 size = compressed.data.size ();
+	if (total_bytes_.fetch_add (size) + size > max_total_bytes_) {
+		total_bytes_.fetch_sub (size);
+		qDebug () << "disk cache: full, not storing" << render_info;
+		return;
+	}
+	QSaveFile file (entry_path (render_info));
+	if (!file.open (QFile::WriteOnly)) {
+		total_bytes_.fetch_sub (size);
+		return;
+	}
+	QDataStream stream (&file);
+	stream << file_magic << file_version << compressed.codec->name ()
+	       << qint32 (compressed.size.width ()) << qint32 (compressed.size.height ())
+	       << qint32 (compressed.bytes_per_line) << qint32 (compressed.image_format)
+	       << compressed.color_table << compressed.data;
+	if (stream.status () != QDataStream::Ok || !file.commit ()) {
+		qDebug () << "disk cache: unable to store" << file.fileName ();
+		total_bytes_.fetch_sub (size);
+	}
+}
+
+} // namespace Render
@@ -18,10 +18,15 @@
 #include <cstdio>
 
 #include <QCoreApplication>
+#include <QCryptographicHash>
 #include <QDebugStateSaver>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QImage>
 #include <QTextStream>
+#include <QThread>
+#include <QThreadStorage>
+#include <QVariant>
 #include <poppler-qt5.h>
 
 #include "action.h"
@@ -98,8 +103,8 @@ void add_page_actions (std::vector<std::unique_ptr<Action::Base>> & actions,
 	}
 }
 
-PageInfo::PageInfo (std::unique_ptr<Poppler::Page> page, int index)
-    : poppler_page_ (std::move (page)), index_ (index) {
+PageInfo::PageInfo (const Document & document, std::unique_ptr<Poppler::Page> page, int index)
+    : document_ (document), poppler_page_ (std::move (page)), index_ (index) {
 	// precompute height_for_width_ratio
 	auto page_size_dots = poppler_page_->pageSizeF ();
 	if (!page_size_dots.isEmpty ())
@@ -123,7 +128,35 @@ QSize PageInfo::render_size (const QSize & box) const {
 	return (page_size_dots * pix_dots_ratio).toSize ();
 }
 
-QImage PageInfo::render (const QSize & box) const {
+// Poppler callbacks: closure is a RenderClosure, with the callbacks given to PageInfo::render
+namespace {
+	struct RenderClosure {
+		const std::function<bool()> & should_abort;
+		const std::function<void(const QImage &)> & partial_update;
+		QElapsedTimer since_partial_update;
+	};
+	RenderClosure & render_closure (const QVariant & closure) {
+		return *static_cast<RenderClosure *> (closure.value<void *> ());
+	}
+} // namespace
+static bool poppler_should_abort_render (const QVariant & closure) {
+	const auto & should_abort = render_closure (closure).should_abort;
+	return should_abort && should_abort ();
+}
+static bool poppler_should_do_partial_update (const QVariant & closure) {
+	const auto & c = render_closure (closure);
+	return c.partial_update &&
+	       c.since_partial_update.hasExpired (PageInfo::partial_update_interval_ms);
+}
+static void poppler_partial_update (const QImage & image, const QVariant & closure) {
+	auto & c = render_closure (closure);
+	c.since_partial_update.restart ();
+	c.partial_update (image);
+}
+
+QImage PageInfo::render (const QSize & box, const QRect & region,
+                         const std::function<bool()> & should_abort,
+                         const std::function<void(const QImage &)> & partial_update) const {
 	// Render the page in the box
 	const auto page_size_dots = poppler_page_->pageSizeF ();
 	if (page_size_dots.isEmpty ())
@@ -132,7 +165,27 @@ QImage PageInfo::render (const QSize & box) const {
 	    std::min (static_cast<qreal> (box.width ()) / page_size_dots.width (),
 	              static_cast<qreal> (box.height ()) / page_size_dots.height ());
 	const qreal dpi = pix_dots_ratio * 72.0;
-	return poppler_page_->renderToImage (dpi, dpi);
+	// Render threads use their own poppler instance, the GUI thread uses the main one
+	const auto * thread_page = document_.poppler_page_for_render_thread (index_);
+	const auto & page = thread_page != nullptr ? *thread_page : *poppler_page_;
+	// Poppler uses -1 for the full page
+	int x = -1, y = -1, w = -1, h = -1;
+	if (!region.isNull ()) {
+		x = region.x ();
+		y = region.y ();
+		w = region.width ();
+		h = region.height ();
+	}
+	if (!should_abort && !partial_update) {
+		return page.renderToImage (dpi, dpi, x, y, w, h);
+	} else {
+		RenderClosure callbacks{should_abort, partial_update, QElapsedTimer ()};
+		callbacks.since_partial_update.start ();
+		auto closure = QVariant::fromValue (static_cast<void *> (&callbacks));
+		return page.renderToImage (dpi, dpi, x, y, w, h, Poppler::Page::Rotate0,
+		                           poppler_partial_update, poppler_should_do_partial_update,
+		                           poppler_should_abort_render, closure);
+	}
 }
 
 const Action::Base * PageInfo::on_click (const QPointF & coord) const {
@@ -188,15 +241,87 @@ void SlideInfo::set_previous_slide (const SlideInfo * slide) {
 
 // Document
 
-Document::Document (const QString & filename, std::unique_ptr<Poppler::Document> document)
-    : filename_ (filename), document_ (std::move (document)) {}
+static void set_render_hints (Poppler::Document & document) {
+	// Enable antialiasing, it is better looking
+	document.setRenderHint (Poppler::Document::Antialiasing, true);
+	document.setRenderHint (Poppler::Document::TextAntialiasing, true);
+}
+
+/* Render thread poppler instances.
+ * Each thread lazily loads its own poppler document from the file data, and pages on demand.
+ * The thread storage deletes them when the thread exits.
+ * The owner pointer prevents using an instance from another Document.
+ */
+namespace {
+	struct RenderThreadDocument {
+		const Document * owner{nullptr};
+		std::unique_ptr<Poppler::Document> document;
+		std::vector<std::unique_ptr<Poppler::Page>> pages;
+	};
+	QThreadStorage<RenderThreadDocument *> render_thread_documents;
+} // namespace
+
+const Poppler::Page * Document::poppler_page_for_render_thread (int page_index) const {
+	if (QThread::currentThread () == qApp->thread ()) {
+		return nullptr;
+	}
+	auto * thread_document = render_thread_documents.localData ();
+	if (thread_document == nullptr || thread_document->owner != this) {
+		thread_document = new RenderThreadDocument;
+		render_thread_documents.setLocalData (thread_document); // Deletes the previous one
+		thread_document->owner = this;
+		thread_document->document.reset (Poppler::Document::loadFromData (file_data_));
+		if (!thread_document->document || thread_document->document->isLocked ()) {
+			qDebug () << "render thread: unable to load document";
+			thread_document->document.reset ();
+			return nullptr;
+		}
+		set_render_hints (*thread_document->document);
+		thread_document->pages.resize (nb_pages ());
+	}
+	if (!thread_document->document) {
+		return nullptr;
+	}
+	auto & page = thread_document->pages.at (page_index);
+	if (!page) {
+		page.reset (thread_document->document->page (page_index));
+	}
+	return page.get ();
+}
+
+Document::Document (const QString & filename, const QByteArray & file_data,
+                    std::unique_ptr<Poppler::Document> document)
+    : filename_ (filename),
+      file_data_ (file_data),
+      document_ (std::move (document)) {}
 Document::~Document () = default;
 
+const QByteArray & Document::content_hash () const {
+	// Hashing a big document takes time: only done if needed
+	if (content_hash_.isEmpty ()) {
+		content_hash_ = QCryptographicHash::hash (file_data_, QCryptographicHash::Sha1).toHex ();
+	}
+	return content_hash_;
+}
+
 std::unique_ptr<const Document> Document::open (const QString & filename,
                                                 const QString & pdfpc_filename) {
 	auto tr = [](const char * str) { return qApp->translate ("Document::open", str); };
 
-	auto poppler_doc = std::unique_ptr<Poppler::Document> (Poppler::Document::load (filename));
+	/* Load the file in memory before giving it to poppler.
+	 * The content can be hashed to identify the document (render disk cache, sessions).
+	 * This also prevents external modifications of the file during the presentation.
+	 */
+	QFile file (filename);
+	if (!file.open (QFile::ReadOnly)) {
+		QTextStream (stderr) << tr ("Error: unable to read file \"%1\"\n").arg (filename);
+		return nullptr;
+	}
+	const QByteArray file_data = file.readAll ();
+	file.close ();
+
+	auto poppler_doc =
+	    std::unique_ptr<Poppler::Document> (Poppler::Document::loadFromData (file_data));
 
 	// Check document has been opened
 	if (!poppler_doc) {
@@ -208,12 +333,11 @@ std::unique_ptr<const Document> Document::open (const QString & filename,
 		return nullptr;
 	}
 
-	// Enable antialiasing, it is better looking
-	poppler_doc->setRenderHint (Poppler::Document::Antialiasing, true);
-	poppler_doc->setRenderHint (Poppler::Document::TextAntialiasing, true);
+	set_render_hints (*poppler_doc);
 
 	// Document creation and staged init
-	auto document = std::unique_ptr<Document>{new Document (filename, std::move (poppler_doc))};
+	auto document = std::unique_ptr<Document>{
+	    new Document (filename, file_data, std::move (poppler_doc))};
 
 	if (!document->discover_document_structure ()) {
 		return nullptr;
@@ -244,7 +368,7 @@ bool Document::discover_document_structure () {
 			                            .arg (filename_);
 			return false;
 		}
-		pages_.emplace_back (make_unique<PageInfo> (std::move (p), i));
+		pages_.emplace_back (make_unique<PageInfo> (*this, std::move (p), i));
 	}
 
 	// Chain PageInfo structs (setup next/prev pointers)
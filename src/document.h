@@ -16,10 +16,13 @@
  */
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <vector>
 
+#include <QByteArray>
 #include <QDebug>
+#include <QRect>
 #include <QString>
 
 namespace Action {
@@ -29,6 +32,7 @@ namespace Poppler {
 class Document;
 class Page;
 } // namespace Poppler
+class Document;
 class PageInfo;
 class SlideInfo;
 
@@ -46,6 +50,8 @@ class SlideInfo;
  *
  * PageInfo describes a pdf page.
  * It can perform rendering, stores sizing information, label, and actions.
+ * Rendering from a non-GUI thread uses a poppler document instance specific to the thread.
+ * This avoids contention on poppler internal state when rendering in parallel.
  *
  * SlideInfo describes a slide (sequence of pages).
  * It stores slide-level annotations.
@@ -66,6 +72,7 @@ class SlideInfo;
  */
 class PageInfo {
 private:
+	const Document & document_;
 	std::unique_ptr<Poppler::Page> poppler_page_;
 	qreal height_for_width_ratio_{0}; // Page aspect ratio, used by GUI
 	std::vector<std::unique_ptr<Action::Base>> actions_;
@@ -78,7 +85,7 @@ private:
 	const PageInfo * previous_page_{nullptr};
 
 public:
-	PageInfo (std::unique_ptr<Poppler::Page> page, int index);
+	PageInfo (const Document & document, std::unique_ptr<Poppler::Page> page, int index);
 
 	// Non copiable / movable, to safely take references on them
 	PageInfo (const PageInfo &) = delete;
@@ -86,6 +93,7 @@ public:
 	PageInfo & operator= (const PageInfo &) = delete;
 	PageInfo & operator= (PageInfo &&) = delete;
 
+	const Document & document () const noexcept { return document_; }
 	int index () const noexcept { return index_; }
 	const SlideInfo * slide () const noexcept { return slide_; }
 	const PageInfo * next_page () const noexcept { return next_page_; }
@@ -95,10 +103,21 @@ public:
 
 	qreal height_for_width_ratio () const noexcept { return height_for_width_ratio_; }
 	QSize render_size (const QSize & box) const; // Which render size can fit in box
-	QImage render (const QSize & box) const;     // Make render in box
+	/* Make render in box. If region is not null, only render this region of the full render.
+	 * should_abort is polled during rendering, if defined: the render stops if it returns true.
+	 * The returned image is then incomplete, and should be discarded.
+	 * partial_update, if defined, receives the partially rendered image during rendering.
+	 * It is called at most every partial_update_interval_ms, from the rendering thread.
+	 */
+	static constexpr int partial_update_interval_ms = 100;
+	QImage render (const QSize & box, const QRect & region = QRect (),
+	               const std::function<bool()> & should_abort = std::function<bool()> (),
+	               const std::function<void(const QImage &)> & partial_update =
+	                   std::function<void(const QImage &)> ()) const;
 
 	// Which action is triggered by a click at relative [0,1]x[0,1] coords ?
 	const Action::Base * on_click (const QPointF & coord) const;
+	const std::vector<std::unique_ptr<Action::Base>> & actions () const { return actions_; }
 
 	// Navigation link setup by document
 	void set_slide (const SlideInfo * slide);
@@ -147,6 +166,8 @@ public:
 class Document {
 private:
 	QString filename_;
+	QByteArray file_data_;            // PDF file content, loaded once
+	mutable QByteArray content_hash_; // Hex hash of file content, computed on first use
 	std::unique_ptr<Poppler::Document> document_;
 	std::vector<std::unique_ptr<PageInfo>> pages_;
 	std::vector<std::unique_ptr<SlideInfo>> slides_;
@@ -158,14 +179,22 @@ public:
 
 	~Document ();
 
+	const QString & filename () const { return filename_; }
+	// Identifies the document content (disk cache, sessions). Not thread safe.
+	const QByteArray & content_hash () const;
+
 	int nb_pages () const { return pages_.size (); }
 	const PageInfo * page (int page_index) const { return pages_.at (page_index).get (); }
 
 	int nb_slides () const { return slides_.size (); }
 	const SlideInfo * slide (int slide_index) const { return slides_.at (slide_index).get (); }
 
+	// Poppler page from the current thread instance, or nullptr if in the GUI thread or on error
+	const Poppler::Page * poppler_page_for_render_thread (int page_index) const;
+
 private:
-	explicit Document (const QString & filename, std::unique_ptr<Poppler::Document> document);
+	Document (const QString & filename, const QByteArray & file_data,
+	          std::unique_ptr<Poppler::Document> document);
 
 	// Init: returns false if failed
 	bool discover_document_structure ();
@@ -19,14 +19,26 @@
 #include <QApplication>
 #include <QCommandLineOption>
 #include <QCommandLineParser>
+#include <QLocale>
+#include <QStandardPaths>
 #include <QStringList>
 #include <QTextStream>
 #include <QTimer>
 
+#ifdef Q_OS_UNIX
+#include <QSocketNotifier>
+#include <csignal>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 #include "action.h"
 #include "controller.h"
 #include "document.h"
+#include "memory.h"
 #include "render.h"
+#include "session.h"
+#include "trace.h"
 #include "views.h"
 #include "window.h"
 
@@ -54,6 +66,37 @@
  * The renderer only interacts with PageViewers (not the controller).
  */
 
+#ifdef Q_OS_UNIX
+/* Render statistics can be printed at any time with SIGUSR1.
+ * A signal handler can only call async-signal-safe functions: it writes to a socket pair.
+ * The other end is watched by the Qt event loop, which prints the statistics.
+ */
+static int statistics_signal_fds[2];
+static void statistics_signal_handler (int) {
+	char c = 1;
+	auto r = ::write (statistics_signal_fds[0], &c, sizeof (c));
+	Q_UNUSED (r);
+}
+static void setup_statistics_signal (Render::System & renderer) {
+	if (::socketpair (AF_UNIX, SOCK_STREAM, 0, statistics_signal_fds) != 0) {
+		return;
+	}
+	auto notifier = new QSocketNotifier (statistics_signal_fds[1], QSocketNotifier::Read, &renderer);
+	QObject::connect (notifier, &QSocketNotifier::activated, [&renderer](int fd) {
+		char c;
+		auto r = ::read (fd, &c, sizeof (c));
+		Q_UNUSED (r);
+		QTextStream out (stderr);
+		renderer.print_statistics (out);
+	});
+	struct sigaction action = {};
+	action.sa_handler = statistics_signal_handler;
+	sigemptyset (&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	sigaction (SIGUSR1, &action, nullptr);
+}
+#endif
+
 int main (int argc, char * argv[]) {
 	// Qt setup
 	QApplication app (argc, argv);
@@ -71,8 +114,9 @@ int main (int argc, char * argv[]) {
 	qRegisterMetaType<Render::Info> ();
 	qRegisterMetaType<Render::Request> ();
 
-	int render_cache_size = 50 * (1 << 20); // 50MB default
-	auto * prefetch_strategy = Render::default_prefetch_strategy ();
+	Render::Options render_options;
+	render_options.strategy = Render::default_prefetch_strategy ();
+	render_options.codec = Render::default_codec ();
 
 	// Command line parsing
 	QCommandLineParser parser;
@@ -93,9 +137,17 @@ int main (int argc, char * argv[]) {
 	QCommandLineOption render_cache_size_option (
 	    QStringList () << "c"
 	                   << "cache",
-	    tr ("Render cache size (default = %1)").arg (size_in_bytes_to_string (render_cache_size)),
+	    tr ("Render cache size, or \"auto\" to use a share of available memory, adapting to memory "
+	        "pressure (default = %1)")
+	        .arg (size_in_bytes_to_string (render_options.cache_size_bytes)),
 	    tr ("size"));
 	parser.addOption (render_cache_size_option);
+	QCommandLineOption hot_cache_size_option (
+	    "hot-cache",
+	    tr ("Size of ready to display renders kept near the current page (default = %1)")
+	        .arg (size_in_bytes_to_string (render_options.hot_cache_size_bytes)),
+	    tr ("size"));
+	parser.addOption (hot_cache_size_option);
 	QCommandLineOption pdfpc_filename_option (QStringList () << "a"
 	                                                         << "annotations",
 	                                          tr ("Annotation file name (default = file.pdfpc)"),
@@ -107,6 +159,56 @@ int main (int argc, char * argv[]) {
 	    tr ("Prefetch strategy (%1)").arg (Render::list_of_prefetch_strategy_names ().join (',')),
 	    tr ("name"));
 	parser.addOption (prefetch_strategy_option);
+	QCommandLineOption cache_codec_option (
+	    "cache-codec",
+	    tr ("Render cache compression codec (%1)").arg (Render::list_of_codec_names ().join (',')),
+	    tr ("name"));
+	parser.addOption (cache_codec_option);
+	QCommandLineOption cache_format_option (
+	    "cache-format",
+	    tr ("Pixel format of cached renders (%1; default = full)")
+	        .arg (Render::list_of_storage_format_names ().join (',')),
+	    tr ("name"));
+	parser.addOption (cache_format_option);
+	const QString disk_cache_root =
+	    QStandardPaths::writableLocation (QStandardPaths::GenericCacheLocation) + "/pdftalk";
+	QCommandLineOption disk_cache_option (
+	    "disk-cache",
+	    tr ("Keep renders in a disk cache, reused across runs (in %1)").arg (disk_cache_root));
+	parser.addOption (disk_cache_option);
+	QCommandLineOption disk_cache_size_option (
+	    "disk-cache-size",
+	    tr ("Size bound of the disk cache, shared by all documents (default = %1)")
+	        .arg (size_in_bytes_to_string (render_options.disk_cache_size_bytes)),
+	    tr ("size"));
+	parser.addOption (disk_cache_size_option);
+	QCommandLineOption prefetch_history_option (
+	    "prefetch-history",
+	    tr ("Let the prefetch strategy learn from previous runs on the document (in %1)")
+	        .arg (disk_cache_root));
+	parser.addOption (prefetch_history_option);
+	QCommandLineOption downscale_ratio_option (
+	    "downscale-ratio",
+	    tr ("Maximum size ratio to make a render by downscaling a bigger cached one, 1 disables "
+	        "(default = %1)")
+	        .arg (render_options.max_downscale_ratio),
+	    tr ("ratio"));
+	parser.addOption (downscale_ratio_option);
+	QCommandLineOption render_threads_option (
+	    "render-threads", tr ("Number of render threads (default = one per core)"), tr ("n"));
+	parser.addOption (render_threads_option);
+	QCommandLineOption stats_option (
+	    "stats", tr ("Print render statistics on exit (also printed on SIGUSR1 signal)"));
+	parser.addOption (stats_option);
+	QCommandLineOption trace_option (
+	    "trace", tr ("Record a timeline of rendering, written on exit (Chrome trace JSON format)"),
+	    tr ("file.json"));
+	parser.addOption (trace_option);
+	QCommandLineOption record_session_option (
+	    "record-session",
+	    tr ("Record navigation and view sizes to a file, to replay with pdftalk-bench"),
+	    tr ("file"));
+	parser.addOption (record_session_option);
 	parser.process (app);
 
 	auto arguments = parser.positionalArguments ();
@@ -118,13 +220,53 @@ int main (int argc, char * argv[]) {
 
 	if (parser.isSet (render_cache_size_option)) {
 		auto size_str = parser.value (render_cache_size_option);
-		int size = string_to_size_in_bytes (size_str);
+		if (size_str == "auto") {
+			// The budget covers all render memory, and the cache gets what is left
+			qint64 budget = Memory::automatic_budget_bytes ();
+			if (budget >= 0) {
+				render_options.cache_size_bytes = budget;
+				render_options.memory_budget_bytes = budget;
+				render_options.adapt_to_memory_pressure = true;
+			} else {
+				QTextStream (stderr)
+				    << tr ("Error: Available memory is unknown, using default cache size\n");
+			}
+		} else {
+			qint64 size = string_to_size_in_bytes (size_str);
+			if (size >= 0) {
+				render_options.cache_size_bytes = size;
+			} else {
+				QTextStream (stderr)
+				    << tr ("Error: Invalid cache size: %1 (from \"%2\"), using default\n")
+				           .arg (size)
+				           .arg (size_str);
+			}
+		}
+	}
+
+	if (parser.isSet (hot_cache_size_option)) {
+		auto size_str = parser.value (hot_cache_size_option);
+		qint64 size = string_to_size_in_bytes (size_str);
 		if (size >= 0) {
-			render_cache_size = size;
+			render_options.hot_cache_size_bytes = size;
 		} else {
-			QTextStream (stderr) << tr ("Error: Invalid cache size: %1 (from \"%2\"), using default\n")
-			                            .arg (size)
-			                            .arg (size_str);
+			QTextStream (stderr)
+			    << tr ("Error: Invalid hot cache size: %1 (from \"%2\"), using default\n")
+			           .arg (size)
+			           .arg (size_str);
+		}
+	}
+
+	if (parser.isSet (disk_cache_size_option)) {
+		auto size_str = parser.value (disk_cache_size_option);
+		qint64 size = string_to_size_in_bytes (size_str);
+		if (size >= 0) {
+			render_options.disk_cache_size_bytes = size;
+		} else {
+			QTextStream (stderr)
+			    << tr ("Error: Invalid disk cache size: %1 (from \"%2\"), using default\n")
+			           .arg (size)
+			           .arg (size_str);
 		}
 	}
 
@@ -137,7 +279,7 @@ int main (int argc, char * argv[]) {
 		auto name = parser.value (prefetch_strategy_option);
 		auto * strategy = Render::select_prefetch_strategy_by_name (name);
 		if (strategy != nullptr) {
-			prefetch_strategy = strategy;
+			render_options.strategy = strategy;
 		} else {
 			QTextStream (stderr)
 			    << tr ("Warning: prefetch strategy \"%1\" not found, falling back to default\n")
@@ -145,16 +287,83 @@ int main (int argc, char * argv[]) {
 		}
 	}
 
+	if (parser.isSet (cache_codec_option)) {
+		auto name = parser.value (cache_codec_option);
+		auto * codec = Render::select_codec_by_name (name);
+		if (codec != nullptr) {
+			render_options.codec = codec;
+		} else {
+			QTextStream (stderr)
+			    << tr ("Warning: cache codec \"%1\" not found, falling back to default\n").arg (name);
+		}
+	}
+
+	if (parser.isSet (cache_format_option)) {
+		auto name = parser.value (cache_format_option);
+		if (!Render::select_storage_format_by_name (name, render_options.storage_format)) {
+			QTextStream (stderr)
+			    << tr ("Warning: cache format \"%1\" not found, falling back to default\n").arg (name);
+		}
+	}
+
+	if (parser.isSet (downscale_ratio_option)) {
+		auto ratio_str = parser.value (downscale_ratio_option);
+		bool ok = false;
+		auto ratio = QLocale ().toDouble (ratio_str, &ok);
+		if (ok) {
+			render_options.max_downscale_ratio = ratio;
+		} else {
+			QTextStream (stderr) << tr ("Error: Invalid downscale ratio: \"%1\", using default\n")
+			                            .arg (ratio_str);
+		}
+	}
+
+	if (parser.isSet (render_threads_option)) {
+		auto threads_str = parser.value (render_threads_option);
+		bool ok = false;
+		auto threads = threads_str.toInt (&ok);
+		if (ok && threads > 0) {
+			render_options.render_threads = threads;
+		} else {
+			QTextStream (stderr)
+			    << tr ("Error: Invalid number of render threads: \"%1\", using default\n")
+			           .arg (threads_str);
+		}
+	}
+
+	if (parser.isSet (trace_option)) {
+		Trace::enable ();
+	}
+
 	auto document = Document::open (filename, pdfpc_filename);
 	if (!document) {
 		return EXIT_FAILURE;
 	}
 
+	if (parser.isSet (disk_cache_option)) {
+		// One directory per document content
+		render_options.disk_cache_directory =
+		    disk_cache_root + '/' + QString::fromLatin1 (document->content_hash ());
+	}
+	if (parser.isSet (prefetch_history_option)) {
+		render_options.strategy_data_directory =
+		    disk_cache_root + '/' + QString::fromLatin1 (document->content_hash ());
+	}
+
+	SessionRecorder * session_recorder = nullptr;
+	if (parser.isSet (record_session_option)) {
+		session_recorder =
+		    SessionRecorder::open (parser.value (record_session_option), *document, &app);
+		if (session_recorder == nullptr) {
+			return EXIT_FAILURE;
+		}
+	}
+
 	// Create all components
 	auto presentation_view = new PresentationView;
 	auto presenter_view = new PresenterView (document->nb_slides ());
 	Controller control (*document, *presenter_view);
-	Render::System renderer (render_cache_size, prefetch_strategy);
+	Render::System renderer (render_options);
 
 	// Global shortcuts
 	add_shortcuts_to_widget (control, presentation_view);
@@ -179,13 +388,36 @@ int main (int argc, char * argv[]) {
 		QObject::connect (v, &PageViewer::action_activated, &control, &Controller::execute_action);
 
 		QObject::connect (v, &PageViewer::request_render, &renderer, &Render::System::request_render);
+		QObject::connect (v, &PageViewer::link_target_hovered, &renderer,
+		                  &Render::System::prefetch_page);
 		QObject::connect (&renderer, &Render::System::new_render, v, &PageViewer::receive_pixmap);
+		if (session_recorder != nullptr) {
+			QObject::connect (v, &PageViewer::request_render, session_recorder,
+			                  &SessionRecorder::record_request);
+		}
 	}
 
 	// Setup window swapping system
 	WindowShifter windows{presentation_view, presenter_view};
 
+#ifdef Q_OS_UNIX
+	setup_statistics_signal (renderer);
+#endif
+
 	// Init system
 	QTimer::singleShot (0, &control, &Controller::bootstrap);
-	return app.exec ();
+	auto status = app.exec ();
+	// Render threads may still write to the trace buffers
+	renderer.shutdown ();
+	if (parser.isSet (stats_option)) {
+		QTextStream out (stderr);
+		renderer.print_statistics (out);
+	}
+	if (parser.isSet (trace_option)) {
+		auto trace_filename = parser.value (trace_option);
+		if (!Trace::write_json_file (trace_filename)) {
+			QTextStream (stderr) << tr ("Error: unable to write trace to \"%1\"\n").arg (trace_filename);
+		}
+	}
+	return status;
 }
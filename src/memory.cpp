@@ -0,0 +1,125 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+
+#include "memory.h"
+
+namespace Memory {
+
+namespace {
+	constexpr qint64 automatic_budget_divisor = 4;
+
+#ifdef Q_OS_LINUX
+	constexpr qint64 low_memory_bytes = qint64 (256) << 20;
+	constexpr double stall_percent_threshold = 10.0;
+
+	QByteArray read_file (const QString & filename) {
+		QFile file (filename);
+		if (!file.open (QFile::ReadOnly)) {
+			return {};
+		}
+		return file.readAll (); // Files in /proc have no size: read until end
+	}
+
+	// Value of "Key: value kB" line in /proc/meminfo, in bytes. -1 if not found.
+	qint64 meminfo_bytes (const QByteArray & meminfo, const QByteArray & key) {
+		for (const auto & line : meminfo.split ('\n')) {
+			if (line.startsWith (key + ':')) {
+				const auto fields = line.mid (key.size () + 1).simplified ().split (' ');
+				bool ok = false;
+				const qint64 value = fields.value (0).toLongLong (&ok);
+				return ok ? value * 1024 : -1;
+			}
+		}
+		return -1;
+	}
+
+	// Number in a cgroup file. -1 if absent, or if it is "max" (no limit).
+	qint64 cgroup_value (const QString & filename) {
+		bool ok = false;
+		const qint64 value = read_file (filename).trimmed ().toLongLong (&ok);
+		return ok ? value : -1;
+	}
+
+	// Room left below the cgroup memory limit, or -1 if there is no limit.
+	qint64 cgroup_available_bytes () {
+		// cgroup v2: "0::/path" line in /proc/self/cgroup
+		for (const auto & line : read_file ("/proc/self/cgroup").split ('\n')) {
+			if (line.startsWith ("0::")) {
+				const QString directory = "/sys/fs/cgroup" + QString::fromLocal8Bit (line.mid (3));
+				const qint64 limit = cgroup_value (directory + "/memory.max");
+				const qint64 usage = cgroup_value (directory + "/memory.current");
+				if (limit >= 0 && usage >= 0) {
+					return std::max (qint64 (0), limit - usage);
+				}
+				return -1;
+			}
+		}
+		// cgroup v1: no limit is reported as a huge value (above any physical memory)
+		const qint64 limit = cgroup_value ("/sys/fs/cgroup/memory/memory.limit_in_bytes");
+		const qint64 usage = cgroup_value ("/sys/fs/cgroup/memory/memory.usage_in_bytes");
+		if (limit >= 0 && usage >= 0 && limit < (qint64 (1) << 50)) {
+			return std::max (qint64 (0), limit - usage);
+		}
+		return -1;
+	}
+#endif
+} // namespace
+
+qint64 available_bytes () {
+#ifdef Q_OS_LINUX
+	qint64 available = meminfo_bytes (read_file ("/proc/meminfo"), "MemAvailable");
+	const qint64 cgroup_available = cgroup_available_bytes ();
+	if (cgroup_available >= 0 && (available < 0 || cgroup_available < available)) {
+		available = cgroup_available;
+	}
+	return available;
+#else
+	return -1;
+#endif
+}
+
+qint64 automatic_budget_bytes () {
+	const qint64 available = available_bytes ();
+	return available >= 0 ? available / automatic_budget_divisor : -1;
+}
+
+bool under_pressure () {
+#ifdef Q_OS_LINUX
+	// "some avg10=1.23 avg60=..." line of /proc/pressure/memory (Linux >= 4.20)
+	for (const auto & line : read_file ("/proc/pressure/memory").split ('\n')) {
+		if (line.startsWith ("some ")) {
+			for (const auto & field : line.split (' ')) {
+				if (field.startsWith ("avg10=") &&
+				    field.mid (6).toDouble () > stall_percent_threshold) {
+					return true;
+				}
+			}
+		}
+	}
+	const qint64 available = available_bytes ();
+	return 0 <= available && available < low_memory_bytes;
+#else
+	return false;
+#endif
+}
+
+} // namespace Memory
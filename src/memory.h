@@ -0,0 +1,42 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <QtGlobal>
+
+/* System memory information, to size and adapt the render memory budget.
+ *
+ * Only implemented for Linux, using /proc and cgroup (v2, or v1) files.
+ * Other systems report unknown values (-1), and never report pressure.
+ */
+namespace Memory {
+
+/* Bytes of memory the process can still use, -1 if unknown.
+ * Minimum of the system MemAvailable, and the room left below the cgroup limit if any.
+ */
+qint64 available_bytes ();
+
+// Render memory budget for automatic sizing: a fraction of available memory, -1 if unknown.
+qint64 automatic_budget_bytes ();
+
+/* Is the system under memory pressure ?
+ * True if tasks stall on memory more than 10% of the time (PSI, "some avg10"),
+ * or if available memory is below 256MiB.
+ */
+bool under_pressure ();
+
+} // namespace Memory
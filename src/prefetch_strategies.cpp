@@ -14,6 +14,22 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QSet>
+#include <QTextStream>
+#include <QtDebug>
+
+#include "action.h"
 #include "controller.h"
 #include "document.h"
 #include "render_internal.h"
@@ -47,6 +63,66 @@ namespace {
 			}
 		} while (n > 0 && current_page != nullptr);
 	}
+
+	/* Prefetch in slide units, from slides_behind slides before to slides_ahead slides after the
+	 * current slide, nearest slides first.
+	 * The current page of a view role can be any page of these slides (all overlays).
+	 * Renders are deduplicated: roles showing the same page for many pages (NextSlide) only
+	 * prefetch it once.
+	 */
+	void prefetch_slides_around (const Request & context,
+	                             const std::function<void(const Info &)> & request_render,
+	                             int slides_ahead, int slides_behind) {
+		QSet<const PageInfo *> prefetched;
+		prefetched.insert (page_for_role (context.current_page (), context.role ()));
+		auto prefetch_slide = [&](const SlideInfo * slide) {
+			if (slide == nullptr) {
+				return;
+			}
+			for (auto * page = slide->first_page (); page != nullptr && page->slide () == slide;
+			     page = page->next_page ()) {
+				auto * render_page = page_for_role (page, context.role ());
+				if (render_page != nullptr && !prefetched.contains (render_page)) {
+					prefetched.insert (render_page);
+					request_render (Info{render_page, context.box_size ()});
+				}
+			}
+		};
+		const auto * current_slide = context.current_page ()->slide ();
+		prefetch_slide (current_slide);
+		const auto * next_slide = current_slide;
+		const auto * previous_slide = current_slide;
+		for (int distance = 1; distance <= std::max (slides_ahead, slides_behind); ++distance) {
+			if (next_slide != nullptr && distance <= slides_ahead) {
+				next_slide = next_slide->next_slide ();
+				prefetch_slide (next_slide);
+			}
+			if (previous_slide != nullptr && distance <= slides_behind) {
+				previous_slide = previous_slide->previous_slide ();
+				prefetch_slide (previous_slide);
+			}
+		}
+	}
+
+	/* Always prefetch the next/prev page for every action.
+	 * When moving, prefetch the 5 next pages in the direction of movement for current page role.
+	 */
+	void prefetch_around (const Request & context,
+	                      const std::function<void(const Info &)> & request_render) {
+		bool has_directional_long_prefetch =
+		    context.role () == ViewRole::CurrentPublic || context.role () == ViewRole::CurrentPresenter;
+
+		if (has_directional_long_prefetch && context.cause () == RedrawCause::ForwardMove) {
+			prefetch_next_n (context, request_render, 5);
+			prefetch_previous_n (context, request_render, 1);
+		} else if (has_directional_long_prefetch && context.cause () == RedrawCause::BackwardMove) {
+			prefetch_next_n (context, request_render, 1);
+			prefetch_previous_n (context, request_render, 5);
+		} else {
+			prefetch_next_n (context, request_render, 1);
+			prefetch_previous_n (context, request_render, 1);
+		}
+	}
 } // namespace
 
 // No prefetch
@@ -54,6 +130,7 @@ class DisabledStrategy : public PrefetchStrategy {
 public:
 	DisabledStrategy () : PrefetchStrategy ("disabled") {}
 	void prefetch (const Request &, const std::function<void(const Info &)> &) final {}
+	bool anticipates () const final { return false; }
 };
 
 /* Reasonnable prefetch:
@@ -66,18 +143,250 @@ public:
 
 	void prefetch (const Request & context,
 	               const std::function<void(const Info &)> & request_render) final {
-		bool has_directional_long_prefetch =
-		    context.role () == ViewRole::CurrentPublic || context.role () == ViewRole::CurrentPresenter;
+		prefetch_around (context, request_render);
+	}
+};
 
-		if (has_directional_long_prefetch && context.cause () == RedrawCause::ForwardMove) {
-			prefetch_next_n (context, request_render, 5);
-			prefetch_previous_n (context, request_render, 1);
-		} else if (has_directional_long_prefetch && context.cause () == RedrawCause::BackwardMove) {
-			prefetch_next_n (context, request_render, 1);
-			prefetch_previous_n (context, request_render, 5);
+/* Prefetch in slide units:
+ * Always prefetch the current, next and previous slides for every action.
+ * When moving, prefetch 2 slides in the direction of movement.
+ * Current page roles get all overlays of these slides, NextSlide the first page of the slides
+ * following them, transition roles the neighbouring overlays.
+ */
+class SlidesStrategy : public PrefetchStrategy {
+public:
+	SlidesStrategy () : PrefetchStrategy ("slides") {}
+
+	void prefetch (const Request & context,
+	               const std::function<void(const Info &)> & request_render) final {
+		if (context.cause () == RedrawCause::ForwardMove) {
+			prefetch_slides_around (context, request_render, 2, 1);
+		} else if (context.cause () == RedrawCause::BackwardMove) {
+			prefetch_slides_around (context, request_render, 1, 2);
 		} else {
-			prefetch_next_n (context, request_render, 1);
-			prefetch_previous_n (context, request_render, 1);
+			prefetch_slides_around (context, request_render, 1, 1);
+		}
+	}
+};
+
+/* Default prefetch, plus the targets of navigation links of the current page.
+ * Hovered links are prefetched with a higher priority by System::prefetch_page.
+ */
+class LinksStrategy : public PrefetchStrategy {
+public:
+	LinksStrategy () : PrefetchStrategy ("links") {}
+
+	void prefetch (const Request & context,
+	               const std::function<void(const Info &)> & request_render) final {
+		prefetch_around (context, request_render);
+
+		const auto * current_page = context.current_page ();
+		for (const auto & action : current_page->actions ()) {
+			auto target_index = action->target_page_index (*current_page);
+			if (target_index >= 0) {
+				auto * target_page = current_page->document ().page (target_index);
+				auto * render_page = page_for_role (target_page, context.role ());
+				if (render_page != nullptr) {
+					request_render (Info{render_page, context.box_size ()});
+				}
+			}
+		}
+	}
+};
+
+/* Default prefetch, plus idle warmup of the whole document.
+ * Warmup renders pages in order of distance to the current page, alternating next and previous.
+ */
+class WarmupStrategy : public PrefetchStrategy {
+public:
+	WarmupStrategy () : PrefetchStrategy ("warmup") {}
+
+	void prefetch (const Request & context,
+	               const std::function<void(const Info &)> & request_render) final {
+		prefetch_around (context, request_render);
+	}
+
+	void warmup (const Request & context,
+	             const std::function<bool(const Info &)> & warmup_render) final {
+		auto warmup_page = [&context, &warmup_render](const PageInfo * page) {
+			auto * render_page = page_for_role (page, context.role ());
+			return render_page == nullptr || warmup_render (Info{render_page, context.box_size ()});
+		};
+		const auto * next = context.current_page ();
+		const auto * previous = context.current_page ();
+		while (next != nullptr || previous != nullptr) {
+			if (next != nullptr) {
+				next = next->next_page ();
+				if (next != nullptr && !warmup_page (next)) {
+					return;
+				}
+			}
+			if (previous != nullptr) {
+				previous = previous->previous_page ();
+				if (previous != nullptr && !warmup_page (previous)) {
+					return;
+				}
+			}
+		}
+	}
+};
+
+/* Learned prefetch: default prefetch, plus the most likely jumps from the current page.
+ *
+ * Page transitions of the current page (CurrentPublic role) are counted (markov chain model).
+ * Sequential moves are already covered by the default prefetch, so only jumps are predicted:
+ * the max_predicted_jumps most frequent ones from the current page, if frequent enough.
+ * Predictions are made for every role, as views follow the current page.
+ *
+ * Pages reached by jumps from several pages are hinted as frequent to the render cache.
+ *
+ * If a data directory is given, transition counts from previous runs are loaded at start.
+ * The updated counts are saved at stop, so the model learns across presentations of the deck.
+ */
+class MarkovStrategy : public PrefetchStrategy {
+private:
+	static constexpr int max_predicted_jumps = 3;
+	static constexpr qreal min_jump_probability = 0.1;
+
+	// transitions_[from][to] = number of observed moves
+	QHash<int, QHash<int, int>> transitions_;
+	int last_page_index_{-1};
+	QString history_filename_;
+
+public:
+	MarkovStrategy () : PrefetchStrategy ("markov") {}
+
+	void start (const QString & data_directory) final {
+		transitions_.clear ();
+		last_page_index_ = -1;
+		history_filename_.clear ();
+		if (!data_directory.isEmpty ()) {
+			history_filename_ = data_directory + "/prefetch_history";
+			load_history ();
+		}
+	}
+	void stop () final {
+		if (!history_filename_.isEmpty ()) {
+			save_history ();
+		}
+	}
+
+	void prefetch (const Request & context,
+	               const std::function<void(const Info &)> & request_render) final {
+		const auto * current_page = context.current_page ();
+		if (context.role () == ViewRole::CurrentPublic && context.cause () != RedrawCause::Resize) {
+			learn_transition (current_page->index ());
+		}
+
+		prefetch_around (context, request_render);
+
+		const auto & document = current_page->document ();
+		for (int target_index : predicted_jumps (current_page->index ())) {
+			if (0 <= target_index && target_index < document.nb_pages ()) {
+				auto * render_page = page_for_role (document.page (target_index), context.role ());
+				if (render_page != nullptr) {
+					request_render (Info{render_page, context.box_size ()});
+				}
+			}
+		}
+	}
+
+	// Jump targets from many pages (agenda, appendix) are kept longer in the cache
+	RenderCache::Hint cache_hint (const Info & render_info) const final {
+		static constexpr int min_jump_sources = 2;
+		const int page_index = render_info.page ()->index ();
+		int nb_jump_sources = 0;
+		for (auto from = transitions_.constBegin (); from != transitions_.constEnd (); ++from) {
+			if (std::abs (from.key () - page_index) > 1 && from->contains (page_index)) {
+				nb_jump_sources++;
+			}
+		}
+		return nb_jump_sources >= min_jump_sources ? RenderCache::Hint::Frequent
+		                                           : RenderCache::Hint::Normal;
+	}
+
+private:
+	void learn_transition (int page_index) {
+		if (last_page_index_ >= 0 && last_page_index_ != page_index) {
+			transitions_[last_page_index_][page_index] += 1;
+		}
+		last_page_index_ = page_index;
+	}
+
+	std::vector<int> predicted_jumps (int page_index) const {
+		auto from = transitions_.constFind (page_index);
+		if (from == transitions_.constEnd ()) {
+			return {};
+		}
+		std::vector<std::pair<int, int>> jumps; // (count, target)
+		int total = 0;
+		for (auto it = from->constBegin (); it != from->constEnd (); ++it) {
+			total += it.value ();
+			if (std::abs (it.key () - page_index) > 1) {
+				jumps.emplace_back (it.value (), it.key ());
+			}
+		}
+		std::sort (jumps.begin (), jumps.end (), std::greater<std::pair<int, int>>{});
+
+		std::vector<int> targets;
+		for (const auto & jump : jumps) {
+			if (static_cast<int> (targets.size ()) == max_predicted_jumps ||
+			    jump.first < min_jump_probability * total) {
+				break;
+			}
+			targets.push_back (jump.second);
+		}
+		return targets;
+	}
+
+	/* History file format: header line, then one "from to count" line per transition.
+	 * Invalid files are ignored, and will be overwritten.
+	 */
+	void load_history () {
+		QFile file (history_filename_);
+		if (!file.open (QFile::ReadOnly | QFile::Text)) {
+			return;
+		}
+		QTextStream in (&file);
+		if (in.readLine () != "pdftalk-prefetch-history 1") {
+			qWarning () << "Prefetch history: ignoring invalid file" << history_filename_;
+			return;
+		}
+		QHash<int, QHash<int, int>> transitions;
+		while (!in.atEnd ()) {
+			const auto fields = in.readLine ().simplified ().split (' ');
+			bool ok[3] = {false, false, false};
+			if (fields.size () == 3) {
+				const int from = fields[0].toInt (&ok[0]);
+				const int to = fields[1].toInt (&ok[1]);
+				const int count = fields[2].toInt (&ok[2]);
+				if (ok[0] && ok[1] && ok[2] && from >= 0 && to >= 0 && count > 0) {
+					transitions[from][to] += count;
+					continue;
+				}
+			}
+			qWarning () << "Prefetch history: ignoring invalid file" << history_filename_;
+			return;
+		}
+		transitions_ = std::move (transitions);
+	}
+	void save_history () const {
+		QDir ().mkpath (QFileInfo (history_filename_).path ());
+		QSaveFile file (history_filename_);
+		if (!file.open (QFile::WriteOnly | QFile::Text)) {
+			qWarning () << "Prefetch history: unable to write" << history_filename_;
+			return;
+		}
+		QTextStream out (&file);
+		out << "pdftalk-prefetch-history 1\n";
+		for (auto from = transitions_.constBegin (); from != transitions_.constEnd (); ++from) {
+			for (auto to = from->constBegin (); to != from->constEnd (); ++to) {
+				out << from.key () << ' ' << to.key () << ' ' << to.value () << '\n';
+			}
+		}
+		out.flush ();
+		if (!file.commit ()) {
+			qWarning () << "Prefetch history: unable to write" << history_filename_;
 		}
 	}
 };
@@ -94,8 +403,13 @@ public:
 namespace {
 	DisabledStrategy disabled;
 	DefaultStrategy defaulted;
+	SlidesStrategy slides;
+	LinksStrategy links;
+	WarmupStrategy warmup;
+	MarkovStrategy markov;
 
-	PrefetchStrategy * defined_strategies[] = {&disabled, &defaulted};
+	PrefetchStrategy * defined_strategies[] = {&disabled, &defaulted, &slides,
+	                                           &links,    &warmup,    &markov};
 } // namespace
 
 QStringList list_of_prefetch_strategy_names () {
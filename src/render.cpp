@@ -14,20 +14,30 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
 #include <QCoreApplication>
 #include <QHash>
 #include <QLocale>
 #include <QMetaType>
+#include <QMutexLocker>
+#include <QSemaphore>
+#include <QThread>
 #include <QThreadPool>
 #include <QtDebug>
 
 #include "document.h"
+#include "memory.h"
 #include "render.h"
 #include "render_internal.h"
+#include "trace.h"
 
 // Byte size conversion
 
-QString size_in_bytes_to_string (int size) {
+QString size_in_bytes_to_string (qint64 size) {
 	qreal num = size;
 	qreal increment = 1024.0;
 	static const char * suffixes[] = {QT_TR_NOOP ("B"),
@@ -45,13 +55,13 @@ QString size_in_bytes_to_string (int size) {
 	return QLocale ().toString (num, 'f', 2) +
 	       qApp->translate ("byte_size_conversion", suffixes[unit_idx]);
 }
-int string_to_size_in_bytes (QString size_str) {
-	int factor = 1;
+qint64 string_to_size_in_bytes (QString size_str) {
+	qint64 factor = 1;
 
 	// Remove suffix if present. Order in the array is important, first match wins.
 	struct SuffixWithFactor {
 		const char * suffix;
-		int factor;
+		qint64 factor;
 	};
 	static const SuffixWithFactor suffixes[] = {
 	    {QT_TR_NOOP ("G"), 1000000000}, {QT_TR_NOOP ("GB"), 1000000000},
@@ -73,7 +83,7 @@ int string_to_size_in_bytes (QString size_str) {
 	bool ok;
 	auto raw_value = QLocale ().toDouble (size_str, &ok);
 	if (ok) {
-		return static_cast<int> (raw_value * factor);
+		return static_cast<qint64> (raw_value * factor);
 	} else {
 		return -1;
 	}
@@ -88,7 +98,7 @@ Info::Info (const PageInfo * p, const QSize & box) : page_ (p) {
 }
 
 bool operator== (const Info & a, const Info & b) {
-	return a.page () == b.page () && a.size () == b.size ();
+	return a.page () == b.page () && a.size () == b.size () && a.quality () == b.quality ();
 }
 bool operator!= (const Info & a, const Info & b) {
 	return !(a == b);
@@ -96,12 +106,15 @@ bool operator!= (const Info & a, const Info & b) {
 uint qHash (const Info & info, uint seed) {
 	using ::qHash; // Have access to Qt's basic qHash
 	return qHash (info.page (), seed) ^ qHash (info.size ().width (), seed) ^
-	       qHash (info.size ().height (), seed);
+	       qHash (info.size ().height (), seed) ^ qHash (static_cast<int> (info.quality ()), seed);
 }
 
 QDebug operator<< (QDebug d, const Info & render_info) {
 	if (!render_info.isNull ()) {
 		d << render_info.page () << render_info.size ();
+		if (render_info.quality () == Quality::Draft) {
+			d << "draft";
+		}
 	} else {
 		d << "Render::Info()";
 	}
@@ -117,117 +130,1267 @@ Request::Request (const PageInfo * current_page, const QSize & box, ViewRole rol
 	Q_ASSERT (cause != RedrawCause::Unknown);
 }
 
+Trace::Args trace_args (const Info & render_info) {
+	if (render_info.isNull ()) {
+		return {};
+	}
+	return {render_info.page ()->index (), render_info.size ()};
+}
+
 // PrefetchStrategy
 
 PrefetchStrategy::PrefetchStrategy (const QString & name) : name_ (name) {}
 
 // Rendering, Compressing / Uncompressing primitives
 
-std::pair<Compressed *, QPixmap> make_render (const Info & render_info) {
-	// Renders, and returns both the pixmap and the compressed image
-	QImage image = render_info.page ()->render (render_info.size ());
-	auto compressed_data = qCompress (image.bits (), image.byteCount ());
-	auto * compressed_render =
-	    new Compressed{compressed_data, image.size (), image.bytesPerLine (), image.format ()};
+static bool is_opaque_32bit_image (const QImage & image) {
+	switch (image.format ()) {
+	case QImage::Format_RGB32:
+		return true;
+	case QImage::Format_ARGB32:
+	case QImage::Format_ARGB32_Premultiplied:
+		for (int y = 0; y < image.height (); ++y) {
+			const auto * line = reinterpret_cast<const QRgb *> (image.constScanLine (y));
+			for (int x = 0; x < image.width (); ++x) {
+				if (qAlpha (line[x]) != 255) {
+					return false;
+				}
+			}
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Returns a palette version of an opaque 32 bit image, or a null image if it has too many colours
+static QImage make_indexed_image (const QImage & image) {
+	QImage indexed = make_pooled_image (image.size (), QImage::Format_Indexed8);
+	if (indexed.isNull ()) {
+		return QImage ();
+	}
+	QHash<QRgb, uchar> index_of_color;
+	QVector<QRgb> color_table;
+	// Slides have long runs of the same colour: avoid most hash table lookups
+	QRgb last_color = 0;
+	uchar last_index = 0;
+	bool has_last = false;
+	for (int y = 0; y < image.height (); ++y) {
+		const auto * line = reinterpret_cast<const QRgb *> (image.constScanLine (y));
+		auto * indexed_line = indexed.scanLine (y);
+		for (int x = 0; x < image.width (); ++x) {
+			const QRgb color = line[x];
+			if (!has_last || color != last_color) {
+				auto it = index_of_color.constFind (color);
+				if (it == index_of_color.constEnd ()) {
+					if (color_table.size () == 256) {
+						return QImage ();
+					}
+					it = index_of_color.insert (color, uchar (color_table.size ()));
+					color_table.append (color);
+				}
+				last_color = color;
+				last_index = it.value ();
+				has_last = true;
+			}
+			indexed_line[x] = last_index;
+		}
+	}
+	indexed.setColorTable (color_table);
+	return indexed;
+}
+
+static QImage convert_to_storage_format (const QImage & image, StorageFormat format) {
+	if (format == StorageFormat::Full || !is_opaque_32bit_image (image)) {
+		return image;
+	}
+	auto indexed = make_indexed_image (image);
+	if (!indexed.isNull ()) {
+		return indexed;
+	}
+	return image.convertToFormat (format == StorageFormat::Lossy ? QImage::Format_RGB16
+	                                                             : QImage::Format_RGB888);
+}
+
+static void xor_bytes (uchar * target, const uchar * source, int size) {
+	for (int i = 0; i < size; ++i) {
+		target[i] ^= source[i];
+	}
+}
+
+static int pixels_size (const Compressed & render) {
+	return render.bytes_per_line * render.size.height ();
+}
+
+/* Uncompress the pixels of a render to a buffer of pixels_size (render) bytes.
+ * Deltas from its references are applied, using a temporary buffer from the pool.
+ * Returns false on error.
+ */
+static bool uncompress_pixels (const Compressed & render, const ReferenceChain & references,
+                               uchar * pixels) {
+	Q_ASSERT (render.reference.isNull () == references.isEmpty ());
+	const int size = pixels_size (render);
+	auto uncompress = [size](const Compressed & r, uchar * output) {
+		Q_ASSERT (r.codec != nullptr);
+		return pixels_size (r) == size && r.codec->uncompress (r.data, output, size);
+	};
+	// Start from the standalone render at the end of the chain
+	if (!uncompress (references.isEmpty () ? render : references.last (), pixels)) {
+		return false;
+	}
+	if (references.isEmpty ()) {
+		return true;
+	}
+	PooledBuffer delta (BufferPool::instance ().acquire (size));
+	if (delta == nullptr) {
+		return false;
+	}
+	for (int i = references.size () - 2; i >= -1; --i) {
+		if (!uncompress (i >= 0 ? references[i] : render, delta.get ())) {
+			return false;
+		}
+		xor_bytes (pixels, delta.get (), size);
+	}
+	return true;
+}
+
+// Replace the data of a render by a delta against the reference, if it is smaller.
+static void try_delta_encoding (Compressed & render, const QImage & stored,
+                                const DeltaReference & delta_reference) {
+	if (delta_reference.chain.isEmpty ()) {
+		return;
+	}
+	const auto & reference = delta_reference.chain.first ();
+	if (reference.size != render.size || reference.image_format != render.image_format ||
+	    reference.bytes_per_line != render.bytes_per_line) {
+		return;
+	}
+	const int size = pixels_size (render);
+	PooledBuffer delta (BufferPool::instance ().acquire (size));
+	if (delta == nullptr ||
+	    !uncompress_pixels (reference, delta_reference.chain.mid (1), delta.get ())) {
+		return;
+	}
+	xor_bytes (delta.get (), stored.constBits (), size);
+	auto delta_data = render.codec->compress (delta.get (), size);
+	if (delta_data.size () < render.data.size ()) {
+		render.data = delta_data;
+		render.reference = delta_reference.info;
+		render.reference_id = reference.id;
+	}
+}
+
+static std::pair<Compressed *, QPixmap>
+make_compressed_render (QImage image, const RenderParameters & parameters,
+                        const DeltaReference & delta_reference) {
+	// Failed render (poppler, allocation): nothing to cache, not even an empty entry
+	if (image.isNull ()) {
+		return {nullptr, QPixmap ()};
+	}
+	const auto & codec = *parameters.codec;
+	const QImage stored = convert_to_storage_format (image, parameters.storage_format);
+	auto compressed_data = codec.compress (stored.constBits (), stored.byteCount ());
+	if (compressed_data.isNull ()) {
+		return {nullptr, QPixmap ()};
+	}
+	auto * compressed_render = new Compressed{compressed_data, stored.size (), stored.bytesPerLine (),
+	                                          stored.format (), &codec, stored.colorTable (),
+	                                          0, Info (), 0};
+	try_delta_encoding (*compressed_render, stored, delta_reference);
+	// The pixmap is made from the full image, so a lossy format only affects cached renders
 	return {compressed_render, QPixmap::fromImage (std::move (image))};
 }
 
+/* Tiled rendering.
+ * Tiles are rendered in a dedicated thread pool, separate from the one running Tasks.
+ * Tasks wait for their tiles: using the same pool could deadlock if all threads are waiting.
+ * The thread calling render_page renders the first tile itself.
+ */
+namespace {
+	constexpr int min_tile_height_px = 64;
+
+	// Tile threads are kept alive, to keep their poppler document instances (see PageInfo)
+	class TileThreadPool : public QThreadPool {
+	public:
+		TileThreadPool () { setExpiryTimeout (-1); }
+	};
+	QThreadPool & tile_thread_pool () {
+		static TileThreadPool pool;
+		return pool;
+	}
+
+	/* Partial updates of tiles are copied in a full size canvas, shared by tiles.
+	 * The canvas is given to partial_update, at most every partial_update_interval_ms.
+	 */
+	class TiledPartialUpdate {
+	private:
+		const std::function<void(const QImage &)> & partial_update_;
+		QMutex mutex_;
+		QImage canvas_;
+		QElapsedTimer since_update_;
+
+	public:
+		explicit TiledPartialUpdate (const std::function<void(const QImage &)> & partial_update)
+		    : partial_update_ (partial_update) {
+			since_update_.start ();
+		}
+
+		void tile_update (const QImage & tile, const QRect & region, const QSize & size) {
+			QMutexLocker lock (&mutex_);
+			if (canvas_.isNull ()) {
+				canvas_ = QImage (size, tile.format ());
+				canvas_.fill (Qt::white);
+			}
+			if (tile.format () != canvas_.format () || tile.size () != region.size ()) {
+				return;
+			}
+			const auto line_bytes = std::min (canvas_.bytesPerLine (), tile.bytesPerLine ());
+			for (int y = 0; y < region.height (); ++y) {
+				std::memcpy (canvas_.scanLine (region.top () + y), tile.constScanLine (y), line_bytes);
+			}
+			if (since_update_.hasExpired (PageInfo::partial_update_interval_ms)) {
+				since_update_.restart ();
+				partial_update_ (canvas_);
+			}
+		}
+	};
+
+	class TileTask : public QRunnable {
+	private:
+		const PageInfo * page_;
+		QSize box_;
+		QRect region_;
+		const std::function<bool()> & should_abort_;
+		std::function<void(const QImage &)> partial_update_;
+		QImage & result_;
+		QSemaphore & done_;
+
+	public:
+		TileTask (const PageInfo * page, const QSize & box, const QRect & region,
+		          const std::function<bool()> & should_abort,
+		          const std::function<void(const QImage &)> & partial_update, QImage & result,
+		          QSemaphore & done)
+		    : page_ (page),
+		      box_ (box),
+		      region_ (region),
+		      should_abort_ (should_abort),
+		      partial_update_ (partial_update),
+		      result_ (result),
+		      done_ (done) {}
+
+		void run () Q_DECL_FINAL {
+			Trace::Scope trace ("render_tile", Trace::Args (page_->index (), region_.size ()));
+			result_ = page_->render (box_, region_, should_abort_, partial_update_);
+			done_.release ();
+		}
+	};
+} // namespace
+
+static QImage render_page (const Info & render_info, int tile_min_pixels,
+                           const std::function<bool()> & should_abort,
+                           const std::function<void(const QImage &)> & partial_update) {
+	const auto & size = render_info.size ();
+	const int nb_tiles = std::min (QThread::idealThreadCount (), size.height () / min_tile_height_px);
+	if (tile_min_pixels <= 0 || nb_tiles <= 1 || size.width () * size.height () < tile_min_pixels) {
+		return render_info.page ()->render (size, QRect (), should_abort, partial_update);
+	}
+
+	// Horizontal bands of the full render
+	std::vector<QRect> regions;
+	std::vector<QImage> tiles (nb_tiles);
+	for (int i = 0; i < nb_tiles; ++i) {
+		const int top = i * size.height () / nb_tiles;
+		const int bottom = (i + 1) * size.height () / nb_tiles;
+		regions.emplace_back (0, top, size.width (), bottom - top);
+	}
+	TiledPartialUpdate tiled_partial_update (partial_update);
+	auto tile_partial_update = [&](int i) -> std::function<void(const QImage &)> {
+		if (!partial_update) {
+			return {};
+		}
+		return [&tiled_partial_update, &regions, &size, i](const QImage & tile) {
+			tiled_partial_update.tile_update (tile, regions[i], size);
+		};
+	};
+	QSemaphore done;
+	for (int i = 1; i < nb_tiles; ++i) {
+		tile_thread_pool ().start (new TileTask (render_info.page (), size, regions[i], should_abort,
+		                                         tile_partial_update (i), tiles[i], done));
+	}
+	tiles[0] = render_info.page ()->render (size, regions[0], should_abort, tile_partial_update (0));
+	done.acquire (nb_tiles - 1);
+	if (should_abort ()) {
+		return QImage ();
+	}
+
+	// Stitch. Tiles should share the format and width of the first one, or give up.
+	const auto format = tiles[0].format ();
+	for (int i = 0; i < nb_tiles; ++i) {
+		if (tiles[i].format () != format || tiles[i].size () != regions[i].size ()) {
+			qDebug () << "-> tiling failed" << render_info;
+			return render_info.page ()->render (size, QRect (), should_abort);
+		}
+	}
+	QImage image = make_pooled_image (size, format);
+	if (image.isNull ()) {
+		return QImage ();
+	}
+	const auto line_bytes = std::min (image.bytesPerLine (), tiles[0].bytesPerLine ());
+	for (int i = 0; i < nb_tiles; ++i) {
+		for (int y = 0; y < regions[i].height (); ++y) {
+			std::memcpy (image.scanLine (regions[i].top () + y), tiles[i].constScanLine (y),
+			             line_bytes);
+		}
+	}
+	return image;
+}
+
+std::pair<Compressed *, QPixmap>
+make_render (const Info & render_info, const RenderParameters & parameters,
+             const std::function<bool()> & should_abort, const DeltaReference & delta_reference,
+             const std::function<void(const QImage &)> & partial_update) {
+	// Renders, and returns both the pixmap and the compressed image
+	QImage image;
+	{
+		Trace::Scope trace ("render_page", trace_args (render_info));
+		image = render_page (render_info, parameters.tile_min_pixels, should_abort, partial_update);
+	}
+	if (should_abort () || image.isNull ()) {
+		return {nullptr, QPixmap ()};
+	}
+	Trace::Scope trace ("compress", trace_args (render_info));
+	return make_compressed_render (std::move (image), parameters, delta_reference);
+}
+
+std::pair<Compressed *, QPixmap>
+make_downscaled_render (const Info & render_info, const Compressed & source,
+                        const ReferenceChain & source_references,
+                        const RenderParameters & parameters,
+                        const std::function<bool()> & should_abort,
+                        const DeltaReference & delta_reference) {
+	Trace::Scope trace ("downscale", trace_args (render_info));
+	QImage source_image = make_image_from_compressed_render (source, source_references);
+	if (source_image.isNull ()) {
+		return make_render (render_info, parameters, should_abort, delta_reference);
+	}
+	// Qt smooth scaling is an area averaging filter when downscaling, with SIMD implementations.
+	return make_compressed_render (
+	    source_image.scaled (render_info.size (), Qt::IgnoreAspectRatio, Qt::SmoothTransformation),
+	    parameters, delta_reference);
+}
+
+QPixmap make_draft_render (const Info & render_info, const Compressed * source,
+                           const ReferenceChain & source_references,
+                           const std::function<bool()> & should_abort) {
+	static constexpr int draft_resolution_divisor = 4;
+	Trace::Scope trace ("draft", trace_args (render_info));
+	QImage image;
+	if (source != nullptr) {
+		image = make_image_from_compressed_render (*source, source_references);
+	}
+	if (image.isNull ()) {
+		image = render_info.page ()->render (render_info.size () / draft_resolution_divisor,
+		                                     QRect (), should_abort);
+	}
+	if (should_abort () || image.isNull ()) {
+		return QPixmap ();
+	}
+	// Bilinear filtering when upscaling, cheap compared to a full render
+	return QPixmap::fromImage (
+	    image.scaled (render_info.size (), Qt::IgnoreAspectRatio, Qt::SmoothTransformation));
+}
+
 static void qbytearray_deleter (void * p) {
 	delete static_cast<QByteArray *> (p);
 }
-QPixmap make_pixmap_from_compressed_render (const Compressed & render) {
-	// Recreate an image and then a pixmap from compressed data
-	// Try to avoid any useless copy by using the non-owning QImage constructor
-	auto * uncompressed_data = new QByteArray;
-	*uncompressed_data = qUncompress (render.data);
-	QImage image (reinterpret_cast<uchar *> (uncompressed_data->data ()), render.size.width (),
-	              render.size.height (), render.bytes_per_line, render.image_format,
-	              &qbytearray_deleter, uncompressed_data);
-	return QPixmap::fromImage (std::move (image));
+QImage make_image_from_compressed_render (const Compressed & render,
+                                          const ReferenceChain & references) {
+	// Recreate an image from compressed data
+	Q_ASSERT (render.codec != nullptr);
+	if (render.codec->data_is_pixels () && references.isEmpty () && render.color_table.isEmpty () &&
+	    render.data.size () == pixels_size (render)) {
+		// Share the cache buffer, using the read-only variant of the non-owning QImage constructor.
+		// Setting the colour table of a read-only image would copy it: not done for palettes.
+		auto * data = new QByteArray (render.data);
+		return QImage (reinterpret_cast<const uchar *> (data->constData ()), render.size.width (),
+		               render.size.height (), render.bytes_per_line, render.image_format,
+		               &qbytearray_deleter, data);
+	}
+	// Uncompress directly in a pooled image buffer
+	QImage image = make_pooled_image (render.size, render.bytes_per_line, render.image_format);
+	if (image.isNull ()) {
+		return QImage ();
+	}
+	if (!uncompress_pixels (render, references, image.bits ())) {
+		qDebug () << "-> corrupted cache entry for codec" << render.codec->name ();
+		return QImage ();
+	}
+	if (!render.color_table.isEmpty ()) {
+		image.setColorTable (render.color_table);
+	}
+	return image;
+}
+QPixmap make_pixmap_from_compressed_render (const Compressed & render,
+                                            const ReferenceChain & references) {
+	return QPixmap::fromImage (make_image_from_compressed_render (render, references));
+}
+
+// Task
+
+void Task::set_downscale_source (const Compressed & source, const ReferenceChain & references) {
+	downscale_source_.reset (new Compressed (source));
+	downscale_source_references_ = references;
+}
+void Task::set_decode_source (const Compressed & source, const ReferenceChain & references) {
+	set_downscale_source (source, references);
+	decode_only_ = true;
+}
+void Task::set_delta_reference (const DeltaReference & delta_reference) {
+	delta_reference_ = delta_reference;
+}
+void Task::set_requested () {
+	requested_ = true;
+}
+
+void Task::run () {
+	const auto args = trace_args (render_info_);
+	Trace::complete ("queued", queued_at_, args);
+	Trace::Scope trace ("task", args);
+
+	const auto & abort_flag = *abort_flag_;
+	const std::function<bool()> should_abort = [&abort_flag]() { return abort_flag.load (); };
+	if (decode_only_) {
+		// Aborted decodes are untracked: signal nothing, as a null pixmap means a decode failure
+		if (!should_abort ()) {
+			Trace::Scope trace ("decode", args);
+			auto pixmap =
+			    make_pixmap_from_compressed_render (*downscale_source_, downscale_source_references_);
+			emit finished_decoding (render_info_, pixmap);
+		}
+		return;
+	}
+	if (should_abort ()) {
+		emit finished_rendering (render_info_, nullptr, QPixmap (), false);
+		return;
+	}
+
+	if (render_info_.quality () == Quality::Draft) {
+		// The downscale source is the draft source, if any
+		auto pixmap = make_draft_render (render_info_, downscale_source_.get (),
+		                                 downscale_source_references_, should_abort);
+		emit finished_rendering (render_info_, nullptr, pixmap, false);
+		return;
+	}
+
+	const auto * disk_cache = parameters_.disk_cache.get ();
+	if (downscale_source_) {
+		// Not stored on disk: disk entries are reserved to full quality renders.
+		auto result = make_downscaled_render (render_info_, *downscale_source_,
+		                                      downscale_source_references_, parameters_, should_abort,
+		                                      delta_reference_);
+		if (result.first == nullptr && !should_abort ()) {
+			emit failed_rendering (render_info_);
+			return;
+		}
+		emit finished_rendering (render_info_, result.first, result.second, false);
+		return;
+	}
+	if (disk_cache != nullptr) {
+		// Lossy entries may have been stored by a run with other options
+		Compressed stored;
+		if (disk_cache->load (render_info_, stored) &&
+		    (stored.image_format != QImage::Format_RGB16 ||
+		     parameters_.storage_format == StorageFormat::Lossy)) {
+			// Decode requested renders here, not in the GUI thread. A decode failure is a miss.
+			QPixmap pixmap;
+			if (requested_) {
+				Trace::Scope trace ("decode", args);
+				pixmap = make_pixmap_from_compressed_render (stored);
+			}
+			if (!requested_ || !pixmap.isNull ()) {
+				emit finished_rendering (render_info_, new Compressed (stored), pixmap, true);
+				return;
+			}
+		}
+	}
+	std::function<void(const QImage &)> partial_update;
+	if (requested_) {
+		partial_update = [this](const QImage & image) { emit partial_rendering (render_info_, image); };
+	}
+	auto result =
+	    make_render (render_info_, parameters_, should_abort, delta_reference_, partial_update);
+	if (result.first == nullptr && !should_abort ()) {
+		emit failed_rendering (render_info_);
+		return;
+	}
+	if (disk_cache != nullptr && result.first != nullptr) {
+		// Store after the signal, to not delay the render.
+		// Ownership of result.first is given by the signal, so take a (shallow) copy before.
+		Compressed to_store = *result.first;
+		emit finished_rendering (render_info_, result.first, result.second, false);
+		if (!to_store.reference.isNull ()) {
+			// Disk entries are standalone: compress again without delta
+			const int size = pixels_size (to_store);
+			PooledBuffer pixels (BufferPool::instance ().acquire (size));
+			if (pixels == nullptr ||
+			    !uncompress_pixels (to_store, delta_reference_.chain, pixels.get ())) {
+				return;
+			}
+			to_store.data = to_store.codec->compress (pixels.get (), size);
+			to_store.reference = Info ();
+			to_store.reference_id = 0;
+		}
+		disk_cache->store (render_info_, to_store);
+	} else {
+		emit finished_rendering (render_info_, result.first, result.second, false);
+	}
+}
+
+// HotCache
+
+static qint64 pixmap_size_in_bytes (const QPixmap & pixmap) {
+	return qint64 (pixmap.width ()) * pixmap.height () * pixmap.depth () / 8;
+}
+
+HotCache::HotCache (qint64 max_bytes, int window) : max_bytes_ (max_bytes), window_ (window) {}
+
+QPixmap HotCache::find (const Info & render_info) const {
+	return pixmaps_.value (render_info);
+}
+
+void HotCache::insert (const Info & render_info, const QPixmap & pixmap) {
+	if (!enabled () || pixmap.isNull () || !in_window (render_info)) {
+		return;
+	}
+	auto it = pixmaps_.find (render_info);
+	if (it != pixmaps_.end ()) {
+		remove (it);
+	}
+	const qint64 bytes = pixmap_size_in_bytes (pixmap);
+	if (bytes > max_bytes_) {
+		return;
+	}
+	// Evict the farthest pages until the new pixmap fits. Ties are broken arbitrarily.
+	while (total_bytes_ + bytes > max_bytes_) {
+		auto farthest = pixmaps_.begin ();
+		for (auto candidate = pixmaps_.begin (); candidate != pixmaps_.end (); ++candidate) {
+			if (distance (candidate.key ()) > distance (farthest.key ())) {
+				farthest = candidate;
+			}
+		}
+		if (distance (farthest.key ()) < distance (render_info)) {
+			return; // Not worth evicting closer pages
+		}
+		remove (farthest);
+	}
+	pixmaps_.insert (render_info, pixmap);
+	total_bytes_ += bytes;
+}
+
+void HotCache::set_current_page (int page_index) {
+	if (page_index == current_page_index_) {
+		return;
+	}
+	current_page_index_ = page_index;
+	auto it = pixmaps_.begin ();
+	while (it != pixmaps_.end ()) {
+		if (!in_window (it.key ())) {
+			qDebug () << "-> demote  " << it.key ();
+			it = remove (it);
+		} else {
+			++it;
+		}
+	}
+}
+
+bool HotCache::in_window (const Info & render_info) const {
+	return distance (render_info) <= window_;
+}
+int HotCache::distance (const Info & render_info) const {
+	return std::abs (render_info.page ()->index () - current_page_index_);
+}
+QHash<Info, QPixmap>::iterator HotCache::remove (QHash<Info, QPixmap>::iterator it) {
+	total_bytes_ -= pixmap_size_in_bytes (it.value ());
+	return pixmaps_.erase (it);
 }
 
 // System impl
 
-System::System (int cache_size_bytes, PrefetchStrategy * strategy)
-    : d_ (new SystemPrivate (cache_size_bytes, strategy, this)) {}
+System::System (const Options & options) : d_ (new SystemPrivate (options, this)) {}
 
 void System::request_render (const Request & request) {
 	d_->request_render (request);
 }
 
-SystemPrivate::SystemPrivate (int cache_size_bytes, PrefetchStrategy * strategy, System * parent)
+void System::prefetch_page (const PageInfo * page) {
+	d_->prefetch_page (page);
+}
+
+void System::print_statistics (QTextStream & out) const {
+	d_->print_statistics (out);
+}
+
+void System::shutdown () {
+	d_->shutdown ();
+}
+
+SystemPrivate::SystemPrivate (const Options & options, System * parent)
     : QObject (parent),
       parent_ (parent),
-      cache_ (cache_size_bytes),
-      prefetch_strategy_ (strategy),
+      hot_cache_ (options.hot_cache_size_bytes, options.hot_cache_window),
+      cache_ (options.cache_size_bytes),
+      cache_size_bytes_ (options.cache_size_bytes),
+      memory_budget_bytes_ (options.memory_budget_bytes),
+      render_parameters_{options.codec, options.storage_format,
+                         options.disk_cache_directory.isEmpty ()
+                             ? nullptr
+                             : std::make_shared<DiskCache> (options.disk_cache_directory,
+                                                            options.disk_cache_size_bytes),
+                         options.tile_min_pixels},
+      max_downscale_ratio_ (options.max_downscale_ratio),
+      scheduler_ (options.render_threads),
+      prefetch_strategy_ (options.strategy),
       prefetch_render_lambda_ ([this](const Info & render_info) {
 	      qDebug () << "prefetch   " << render_info;
-	      this->perform_render (render_info, RenderType::Prefetch);
-      }) {}
+	      Q_ASSERT (this->current_prefetch_plan_ != nullptr);
+	      this->current_prefetch_plan_->insert (render_info);
+	      auto priority = Priority::FarPrefetch;
+	      if (!render_info.isNull () &&
+	          std::abs (render_info.page ()->index () - this->current_prefetch_origin_) <= 1) {
+		      priority = Priority::NearPrefetch;
+	      }
+	      this->perform_render (render_info, RenderType::Prefetch, priority);
+      }) {
+	if (prefetch_strategy_ != nullptr) {
+		prefetch_strategy_->start (options.strategy_data_directory);
+	}
+	cache_.set_eviction_callback (
+	    [this](const Info & render_info) { statistics_.render_evicted (render_info); });
+	idle_timer_.setSingleShot (true);
+	idle_timer_.setInterval (idle_warmup_delay_ms);
+	connect (&idle_timer_, &QTimer::timeout, this, &SystemPrivate::idle_timeout);
+	if (options.adapt_to_memory_pressure) {
+		connect (&memory_pressure_timer_, &QTimer::timeout, this,
+		         &SystemPrivate::check_memory_pressure);
+		memory_pressure_timer_.start (memory_pressure_poll_ms);
+	}
+}
 
 SystemPrivate::~SystemPrivate () {
+	idle_timer_.stop ();
+	if (prefetch_strategy_ != nullptr) {
+		prefetch_strategy_->stop ();
+	}
 	qDebug () << QString ("Render cache: used %1 out of %2")
-	                 .arg (size_in_bytes_to_string (cache_.totalCost ()),
-	                       size_in_bytes_to_string (cache_.maxCost ()));
+	                 .arg (size_in_bytes_to_string (cache_.total_cost ()),
+	                       size_in_bytes_to_string (cache_.max_cost ()));
+	qDebug () << QString ("Hot pixmap cache: used %1 out of %2")
+	                 .arg (size_in_bytes_to_string (hot_cache_.total_bytes ()),
+	                       size_in_bytes_to_string (hot_cache_.max_bytes ()));
+	shutdown ();
+}
+
+void SystemPrivate::shutdown () {
+	// Do not wait for renders on exit: remove queued tasks, and abort running ones.
+	// Running tasks must still be waited for, as they use the document.
+	scheduler_.clear ();
+	decode_pool_.clear ();
+	for (const auto & running : being_rendered_) {
+		running.abort_flag->store (true);
+	}
+	scheduler_.wait_for_done ();
+	decode_pool_.waitForDone ();
+	// Tasks wait for their tiles, but tile threads may still be finishing (trace, cleanup)
+	tile_thread_pool ().waitForDone ();
+}
+
+void SystemPrivate::print_statistics (QTextStream & out) const {
+	out << QString ("Render cache: used %1 out of %2, %3 entries\n")
+	           .arg (size_in_bytes_to_string (cache_.total_cost ()),
+	                 size_in_bytes_to_string (cache_.max_cost ()))
+	           .arg (cache_.size ());
+	out << QString ("Hot pixmap cache: used %1 out of %2\n")
+	           .arg (size_in_bytes_to_string (hot_cache_.total_bytes ()),
+	                 size_in_bytes_to_string (hot_cache_.max_bytes ()));
+	if (memory_budget_bytes_ > 0) {
+		out << QString ("Render memory budget: %1, cache bound %2 (pressure divisor %3)\n")
+		           .arg (size_in_bytes_to_string (memory_budget_bytes_),
+		                 size_in_bytes_to_string (cache_.max_cost ()))
+		           .arg (1 << pressure_shrink_shift_);
+	}
+	const auto & counters = cache_.counters ();
+	out << QString ("Render cache eviction: %1 probation, %2 protected, %3 with their reference "
+	                "(%4), %5 promoted, %6 ghost hits, %7 pinned skips\n")
+	           .arg (counters.probation_evictions)
+	           .arg (counters.protected_evictions)
+	           .arg (counters.dependent_evictions)
+	           .arg (size_in_bytes_to_string (counters.evicted_bytes))
+	           .arg (counters.promotions)
+	           .arg (counters.ghost_hits)
+	           .arg (counters.pinned_skips);
+	const auto pool = BufferPool::instance ().counters ();
+	out << QString ("Buffer pool: %1 / %2 acquired buffers reused (%3%), %4 allocated, %5 free\n")
+	           .arg (pool.reused)
+	           .arg (pool.acquired)
+	           .arg (pool.acquired > 0 ? 100. * pool.reused / pool.acquired : 0., 0, 'f', 1)
+	           .arg (size_in_bytes_to_string (pool.allocated_bytes),
+	                 size_in_bytes_to_string (pool.free_bytes));
+	statistics_.print (out);
 }
 
 void SystemPrivate::request_render (const Request & request) {
 	auto current_render = request.requested_render ();
+	Trace::Scope trace ("request_render", trace_args (current_render));
 	qDebug () << "request    " << current_render << request.role () << request.cause ();
-	perform_render (current_render, RenderType::Requested);
+	hot_cache_.set_current_page (request.current_page ()->index ());
+	requested_by_role_.insert (request.role (), current_render);
+	last_request_by_role_.insert (request.role (), request);
+	// Pause warmup: its renders become unwanted
+	idle_timer_.stop ();
+	warming_up_ = false;
+	warmup_plan_.clear ();
+	anticipated_plan_.clear ();
+	statistics_.request_started (current_render);
+	auto outcome = perform_render (current_render, RenderType::Requested, Priority::Requested);
+	statistics_.request (current_render, request.role (), outcome);
+	auto & prefetch_plan = prefetch_plan_by_role_[request.role ()];
+	prefetch_plan.clear ();
 	if (prefetch_strategy_ != nullptr) {
+		current_prefetch_plan_ = &prefetch_plan;
+		current_prefetch_origin_ = request.current_page ()->index ();
 		prefetch_strategy_->prefetch (request, prefetch_render_lambda_);
+		current_prefetch_plan_ = nullptr;
+	}
+	abort_unwanted_renders ();
+	update_pinned_renders ();
+	update_cache_budget ();
+	if (being_rendered_.isEmpty ()) {
+		on_idle ();
+	}
+}
+
+void SystemPrivate::partial_rendering (Info render_info, QImage image) {
+	// Shown like a draft, while the render is requested, unless a real draft has been shown
+	auto it = being_rendered_.find (render_info);
+	if (it != being_rendered_.end () && it.value ().type == RenderType::Requested &&
+	    !it.value ().draft_shown) {
+		Trace::Scope trace ("partial_update", trace_args (render_info));
+		emit parent_->new_render (render_info.with_quality (Quality::Draft),
+		                          QPixmap::fromImage (image));
 	}
 }
 
-void SystemPrivate::rendering_finished (Info render_info, Compressed * compressed, QPixmap pixmap) {
+void SystemPrivate::prefetch_page (const PageInfo * page) {
+	if (prefetch_strategy_ == nullptr || !prefetch_strategy_->anticipates ()) {
+		return; // Prefetching is disabled
+	}
+	// Replaces the previous anticipated page
+	anticipated_plan_.clear ();
+	if (page != nullptr) {
+		Trace::instant ("prefetch_page", Trace::Args (page->index (), QSize ()));
+		for (auto it = last_request_by_role_.constBegin (); it != last_request_by_role_.constEnd ();
+		     ++it) {
+			const Info render_info{page_for_role (page, it.key ()), it.value ().box_size ()};
+			qDebug () << "anticipate " << render_info;
+			anticipated_plan_.insert (render_info);
+			perform_render (render_info, RenderType::Prefetch, Priority::Anticipated);
+		}
+	}
+	abort_unwanted_renders ();
+	update_pinned_renders ();
+}
+
+void SystemPrivate::rendering_finished (Info render_info, Compressed * compressed, QPixmap pixmap,
+                                        bool from_disk) {
+	Trace::Scope trace ("rendering_finished", trace_args (render_info));
+	// Aborted render: it has already been untracked.
+	if (compressed == nullptr && pixmap.isNull ()) {
+		qDebug () << "aborted    " << render_info;
+		return;
+	}
+	if (render_info.quality () == Quality::Draft) {
+		// Show the draft only if the full render is still wanted and running
+		const auto full_render = render_info.with_quality (Quality::Full);
+		if (being_rendered_.remove (render_info) > 0) {
+			auto it = being_rendered_.find (full_render);
+			if (it != being_rendered_.end ()) {
+				qDebug () << "draft      " << render_info;
+				it.value ().draft_shown = true;
+				emit parent_->new_render (render_info, pixmap);
+			}
+		}
+		return;
+	}
 	// When rendering has finished: store compressed, untrack, give pixmap only if the render was
-	// requested.
-	cache_.insert (render_info, compressed, compressed->data.size ());
-	Q_ASSERT (being_rendered_.contains (render_info));
-	auto type = being_rendered_.take (render_info);
+	// requested. If untracked, the render was aborted too late: only store it.
+	auto it = being_rendered_.find (render_info);
+	if (it == being_rendered_.end ()) {
+		insert_in_cache (render_info, compressed);
+		hot_cache_.insert (render_info, pixmap);
+		return;
+	}
+	auto type = it.value ().type;
+	being_rendered_.erase (it);
+	cancel_draft_render (render_info);
+	if (type == RenderType::Prefetch) {
+		statistics_.prefetch_render_finished (render_info);
+	}
+	if (type == RenderType::Requested && from_disk && pixmap.isNull ()) {
+		// Loaded from disk cache by a prefetch, requested since: decode in a worker thread.
+		const Compressed loaded = *compressed; // Shallow copy, as insertion may delete compressed
+		insert_in_cache (render_info, compressed);
+		cache_.use (render_info); // First use
+		launch_decode (render_info, loaded, ReferenceChain ());
+		warmup_plan_.remove (render_info);
+		update_cache_budget ();
+		return;
+	}
+	insert_in_cache (render_info, compressed);
+	hot_cache_.insert (render_info, pixmap);
 	if (type == RenderType::Requested) {
+		cache_.use (render_info); // First use
+		statistics_.request_served (render_info);
 		emit parent_->new_render (render_info, pixmap);
 	}
+	warmup_plan_.remove (render_info);
+	update_cache_budget ();
+	if (being_rendered_.isEmpty ()) {
+		on_idle ();
+	}
 }
 
-void SystemPrivate::perform_render (const Info & render_info, RenderType type) {
+void SystemPrivate::decoding_finished (Info render_info, QPixmap pixmap) {
+	Trace::Scope trace ("decoding_finished", trace_args (render_info));
+	// Ignore aborted decodes, and decodes replaced by a render
+	auto it = being_rendered_.find (render_info);
+	if (it == being_rendered_.end () || !it.value ().decode) {
+		return;
+	}
+	being_rendered_.erase (it);
+	if (pixmap.isNull ()) {
+		// Unusable entry (corrupted): drop it and render again, once, as the new entry could fail
+		// the same way. Then give up on this render, and only answer the request.
+		qDebug () << "-> unusable" << render_info;
+		cache_.remove (render_info);
+		if (!rerendered_after_decode_failure_.contains (render_info)) {
+			rerendered_after_decode_failure_.insert (render_info);
+			perform_render (render_info, RenderType::Requested, Priority::Requested);
+			return;
+		}
+		emit parent_->new_render (render_info, pixmap);
+		if (being_rendered_.isEmpty ()) {
+			on_idle ();
+		}
+		return;
+	}
+	rerendered_after_decode_failure_.remove (render_info);
+	hot_cache_.insert (render_info, pixmap);
+	statistics_.request_served (render_info);
+	emit parent_->new_render (render_info, pixmap);
+	if (being_rendered_.isEmpty ()) {
+		on_idle ();
+	}
+}
+
+void SystemPrivate::rendering_failed (Info render_info) {
+	// Only answer the request with a null pixmap: rendering again would fail the same way
+	auto it = being_rendered_.find (render_info);
+	if (it == being_rendered_.end () || it.value ().decode) {
+		return;
+	}
+	qDebug () << "failed     " << render_info;
+	auto type = it.value ().type;
+	being_rendered_.erase (it);
+	cancel_draft_render (render_info);
+	if (type == RenderType::Requested) {
+		emit parent_->new_render (render_info, QPixmap ());
+	}
+	warmup_plan_.remove (render_info);
+	if (being_rendered_.isEmpty ()) {
+		on_idle ();
+	}
+}
+
+void SystemPrivate::idle_timeout () {
+	if (!being_rendered_.isEmpty ()) {
+		return; // Not idle anymore, will be called again when renders finish
+	}
+	Trace::instant ("warmup");
+	warming_up_ = true;
+	launch_warmup_batch ();
+}
+
+Statistics::Outcome SystemPrivate::perform_render (const Info & render_info, RenderType type,
+                                                   Priority priority) {
 	// Ignore bad renders (null, too small).
 	static constexpr int pixmap_size_limit_px = 10;
 	if (render_info.isNull () || render_info.size ().width () < pixmap_size_limit_px ||
 	    render_info.size ().height () < pixmap_size_limit_px) {
 		qDebug () << "-> ignored " << render_info;
-		return;
+		return Statistics::Outcome::Ignored;
+	}
+
+	// Take the pixmap from the hot cache if present: no decompression needed.
+	auto hot_pixmap = hot_cache_.find (render_info);
+	if (!hot_pixmap.isNull ()) {
+		qDebug () << "-> hot     " << render_info;
+		if (type == RenderType::Requested) {
+			cache_.use (render_info); // Also a use of the Compressed version
+			statistics_.request_served (render_info);
+			emit parent_->new_render (render_info, hot_pixmap);
+		}
+		return Statistics::Outcome::Hot;
 	}
 
 	// Take the render from the cache is present.
-	const Compressed * compressed_render = cache_.object (render_info);
+	// Only requests are uses: prefetching a render must not protect it from eviction.
+	const Compressed * compressed_render =
+	    type == RenderType::Requested ? cache_.use (render_info) : cache_.find (render_info);
+	ReferenceChain references;
+	if (compressed_render != nullptr && !find_reference_chain (*compressed_render, references)) {
+		// Unusable entry (missing reference): drop it and render again, even for a prefetch
+		qDebug () << "-> unusable" << render_info;
+		cache_.remove (render_info);
+		compressed_render = nullptr;
+	}
 	if (compressed_render != nullptr) {
 		qDebug () << "-> cached  " << render_info;
 		// Only serve if actually requested
-		if (type == RenderType::Requested) {
-			emit parent_->new_render (render_info,
-			                          make_pixmap_from_compressed_render (*compressed_render));
+		if (type != RenderType::Requested) {
+			return Statistics::Outcome::Cached;
 		}
-		return;
+		// Join a running decode (or late render), which will answer the request
+		auto it = being_rendered_.find (render_info);
+		if (it != being_rendered_.end ()) {
+			it.value ().type = RenderType::Requested;
+			return Statistics::Outcome::Cached;
+		}
+		launch_decode (render_info, *compressed_render, references);
+		return Statistics::Outcome::Cached;
 	}
 
 	// If a similar render is running, do nothing: it will answer the request for us.
 	auto it = being_rendered_.find (render_info);
 	if (it != being_rendered_.end ()) {
 		qDebug () << "-> running " << render_info;
+		auto & running = it.value ();
 		// Mark the render as requested now, if it was only a prefetch render.
-		if (type == RenderType::Requested) {
-			it.value () = RenderType::Requested;
+		if (type == RenderType::Requested && running.type == RenderType::Prefetch) {
+			running.type = RenderType::Requested;
+			statistics_.prefetch_render_joined ();
 		}
-		return;
+		// Raise priority if still queued.
+		if (!running.decode && running.priority < priority) {
+			running.priority = priority;
+			scheduler_.set_priority (running.task_id, priority);
+		}
+		return Statistics::Outcome::Running;
 	}
 
 	// No render running, launch our own
-	qDebug () << "-> launch  " << render_info;
-	being_rendered_.insert (render_info, type);
-	auto * task = new Task (render_info);
+	auto abort_flag = std::make_shared<std::atomic<bool>> (false);
+	auto * task = new Task (render_info, render_parameters_, abort_flag);
+	const Compressed * downscale_source = find_downscale_source (render_info);
+	ReferenceChain downscale_source_references;
+	const bool downscaled = downscale_source != nullptr &&
+	                        find_reference_chain (*downscale_source, downscale_source_references);
+	if (downscaled) {
+		qDebug () << "-> scale   " << render_info << "from" << downscale_source->size;
+		task->set_downscale_source (*downscale_source, downscale_source_references);
+	} else {
+		qDebug () << "-> launch  " << render_info;
+	}
+	task->set_delta_reference (find_delta_reference (render_info));
 	connect (task, &Task::finished_rendering, this, &SystemPrivate::rendering_finished);
-	QThreadPool::globalInstance ()->start (task);
+	connect (task, &Task::failed_rendering, this, &SystemPrivate::rendering_failed);
+	if (type == RenderType::Requested) {
+		task->set_requested ();
+		connect (task, &Task::partial_rendering, this, &SystemPrivate::partial_rendering);
+	}
+	if (type == RenderType::Requested && !downscaled) {
+		launch_draft_render (render_info); // Queued before, to run first
+	}
+	auto task_id = scheduler_.start (task, priority);
+	being_rendered_.insert (render_info,
+	                        RunningRender{type, priority, abort_flag, task_id, false, false});
+	return Statistics::Outcome::Launched;
+}
+
+void SystemPrivate::launch_decode (const Info & render_info, const Compressed & compressed,
+                                   const ReferenceChain & references) {
+	auto abort_flag = std::make_shared<std::atomic<bool>> (false);
+	auto * task = new Task (render_info, render_parameters_, abort_flag);
+	task->set_decode_source (compressed, references);
+	connect (task, &Task::finished_decoding, this, &SystemPrivate::decoding_finished);
+	decode_pool_.start (task); // Deleted by the pool
+	being_rendered_.insert (
+	    render_info,
+	    RunningRender{RenderType::Requested, Priority::Requested, abort_flag, 0, false, true});
+}
+
+void SystemPrivate::launch_draft_render (const Info & render_info) {
+	static constexpr int draft_min_pixels = 1 << 19;
+	const auto draft_info = render_info.with_quality (Quality::Draft);
+	const auto & size = render_info.size ();
+	if (size.width () * size.height () < draft_min_pixels || being_rendered_.contains (draft_info)) {
+		return;
+	}
+	// A disk cache entry is loaded faster than the draft is rendered
+	const auto * disk_cache = render_parameters_.disk_cache.get ();
+	if (disk_cache != nullptr && disk_cache->contains (render_info)) {
+		return;
+	}
+	auto abort_flag = std::make_shared<std::atomic<bool>> (false);
+	auto * task = new Task (draft_info, render_parameters_, abort_flag);
+	// Draft source: the biggest cached render of the page
+	const Info * best = nullptr;
+	const auto cached_renders = cache_.keys ();
+	for (const auto & candidate : cached_renders) {
+		if (candidate.page () == render_info.page () &&
+		    (best == nullptr || candidate.size ().width () > best->size ().width ())) {
+			best = &candidate;
+		}
+	}
+	const Compressed * source = best != nullptr ? cache_.find (*best) : nullptr;
+	ReferenceChain source_references;
+	if (source != nullptr && find_reference_chain (*source, source_references)) {
+		task->set_downscale_source (*source, source_references);
+	}
+	qDebug () << "-> draft   " << draft_info;
+	connect (task, &Task::finished_rendering, this, &SystemPrivate::rendering_finished);
+	auto task_id = scheduler_.start (task, Priority::Requested);
+	being_rendered_.insert (
+	    draft_info,
+	    RunningRender{RenderType::Requested, Priority::Requested, abort_flag, task_id, false, false});
+}
+
+void SystemPrivate::cancel_draft_render (const Info & render_info) {
+	auto it = being_rendered_.find (render_info.with_quality (Quality::Draft));
+	if (it != being_rendered_.end ()) {
+		if (!scheduler_.cancel (it.value ().task_id)) {
+			it.value ().abort_flag->store (true);
+		}
+		being_rendered_.erase (it);
+	}
+}
+
+const Compressed * SystemPrivate::find_downscale_source (const Info & render_info) {
+	// Select the smallest cached render of the same page which is bigger than the target.
+	// A linear scan of the cache is ok: it only happens before an expensive render.
+	if (!(max_downscale_ratio_ > 1.0)) {
+		return nullptr;
+	}
+	const auto & target = render_info.size ();
+	const auto cached_renders = cache_.keys ();
+	const Info * best = nullptr;
+	for (const auto & candidate : cached_renders) {
+		const auto & size = candidate.size ();
+		if (candidate.page () == render_info.page () && size.width () >= target.width () &&
+		    size.height () >= target.height () &&
+		    size.width () <= max_downscale_ratio_ * target.width () &&
+		    (best == nullptr || size.width () < best->size ().width ())) {
+			best = &candidate;
+		}
+	}
+	return best != nullptr ? cache_.find (*best) : nullptr;
+}
+
+void SystemPrivate::insert_in_cache (const Info & render_info, Compressed * compressed) {
+	if (compressed->size.isEmpty () || compressed->data.isEmpty ()) {
+		delete compressed; // Never cache empty entries, they cannot be decoded
+		return;
+	}
+	if (!compressed->reference.isNull ()) {
+		// The reference may have been evicted or replaced during the render
+		const Compressed * reference = cache_.find (compressed->reference);
+		if (reference == nullptr || reference->id != compressed->reference_id) {
+			qDebug () << "-> orphan  " << render_info;
+			delete compressed;
+			return;
+		}
+	}
+	compressed->id = ++last_compressed_id_;
+	statistics_.compressed_stored (*compressed);
+	auto hint = prefetch_strategy_ != nullptr ? prefetch_strategy_->cache_hint (render_info)
+	                                          : RenderCache::Hint::Normal;
+	cache_.insert (render_info, compressed, compressed->data.size (), hint);
+}
+
+bool SystemPrivate::is_cached (const Info & render_info) {
+	// Usable entries only: perform_render renders unusable ones again
+	const Compressed * compressed = cache_.find (render_info);
+	ReferenceChain references;
+	return compressed != nullptr && find_reference_chain (*compressed, references);
+}
+
+bool SystemPrivate::find_reference_chain (const Compressed & render, ReferenceChain & references) {
+	const Compressed * current = &render;
+	while (!current->reference.isNull ()) {
+		const Compressed * reference = cache_.find (current->reference);
+		if (reference == nullptr || reference->id != current->reference_id) {
+			return false;
+		}
+		references.append (*reference);
+		current = reference;
+	}
+	return true;
+}
+
+DeltaReference SystemPrivate::find_delta_reference (const Info & render_info) {
+	// Previous page of the same slide, at the same size
+	static constexpr int max_delta_chain_length = 4;
+	const auto * page = render_info.page ();
+	const auto * previous_page = page->previous_page ();
+	if (previous_page == nullptr || previous_page->slide () != page->slide ()) {
+		return {};
+	}
+	const Info reference_info (previous_page, render_info.size ());
+	if (reference_info.size () != render_info.size ()) {
+		return {};
+	}
+	const Compressed * reference = cache_.find (reference_info);
+	if (reference == nullptr) {
+		return {};
+	}
+	DeltaReference delta_reference;
+	delta_reference.chain.append (*reference);
+	if (!find_reference_chain (*reference, delta_reference.chain) ||
+	    delta_reference.chain.size () > max_delta_chain_length) {
+		return {};
+	}
+	delta_reference.info = reference_info;
+	return delta_reference;
+}
+
+bool SystemPrivate::is_wanted (const Info & render_info) const {
+	if (render_info.quality () == Quality::Draft) {
+		// Wanted with its full render
+		const auto full_render = render_info.with_quality (Quality::Full);
+		return being_rendered_.contains (full_render) && is_wanted (full_render);
+	}
+	for (const auto & requested : requested_by_role_) {
+		if (requested == render_info) {
+			return true;
+		}
+	}
+	for (const auto & prefetch_plan : prefetch_plan_by_role_) {
+		if (prefetch_plan.contains (render_info)) {
+			return true;
+		}
+	}
+	return warmup_plan_.contains (render_info) || anticipated_plan_.contains (render_info);
+}
+
+void SystemPrivate::abort_unwanted_renders () {
+	auto it = being_rendered_.begin ();
+	while (it != being_rendered_.end ()) {
+		if (!is_wanted (it.key ())) {
+			// Dequeue if not started, or abort
+			if (!it.value ().decode && scheduler_.cancel (it.value ().task_id)) {
+				qDebug () << "-> dequeue " << it.key ();
+			} else {
+				qDebug () << "-> abort   " << it.key ();
+				it.value ().abort_flag->store (true);
+			}
+			it = being_rendered_.erase (it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void SystemPrivate::update_pinned_renders () {
+	QSet<Info> pinned = anticipated_plan_;
+	for (const auto & requested : requested_by_role_) {
+		pinned.insert (requested);
+	}
+	for (const auto & prefetch_plan : prefetch_plan_by_role_) {
+		pinned.unite (prefetch_plan);
+	}
+	cache_.set_pinned (pinned);
+}
+
+void SystemPrivate::update_cache_budget () {
+	qint64 budget = cache_size_bytes_;
+	if (memory_budget_bytes_ > 0) {
+		auto image_bytes = [](const Info & render_info) {
+			return qint64 (render_info.size ().width ()) * render_info.size ().height () * 4;
+		};
+		qint64 other_bytes = hot_cache_.total_bytes ();
+		for (auto it = being_rendered_.constBegin (); it != being_rendered_.constEnd (); ++it) {
+			other_bytes += image_bytes (it.key ());
+		}
+		for (const auto & displayed : requested_by_role_) {
+			if (!displayed.isNull () && hot_cache_.find (displayed).isNull ()) {
+				other_bytes += image_bytes (displayed);
+			}
+		}
+		budget = std::min (budget, std::max (qint64 (0), memory_budget_bytes_ - other_bytes));
+	}
+	cache_.set_max_cost (budget >> pressure_shrink_shift_);
+}
+
+void SystemPrivate::check_memory_pressure () {
+	static constexpr int max_shrink_shift = 4;
+	if (Memory::under_pressure ()) {
+		if (pressure_shrink_shift_ < max_shrink_shift) {
+			pressure_shrink_shift_++;
+			qDebug () << "memory pressure: cache bound divided by" << (1 << pressure_shrink_shift_);
+		}
+		BufferPool::instance ().trim ();
+	} else if (pressure_shrink_shift_ > 0) {
+		pressure_shrink_shift_--;
+	}
+	update_cache_budget ();
+}
+
+void SystemPrivate::on_idle () {
+	if (prefetch_strategy_ == nullptr) {
+		return;
+	}
+	if (warming_up_) {
+		launch_warmup_batch ();
+	} else {
+		idle_timer_.start ();
+	}
+}
+
+void SystemPrivate::launch_warmup_batch () {
+	// Stop before the cache is full, estimating the next render cost with the average cost.
+	const int batch_size = scheduler_.nb_threads ();
+	int nb_launched = 0;
+	auto warmup_render = [this, batch_size, &nb_launched](const Info & render_info) {
+		if (render_info.isNull () || is_cached (render_info) ||
+		    being_rendered_.contains (render_info)) {
+			return true;
+		}
+		const auto & size = render_info.size ();
+		const qint64 estimated_cost = cache_.is_empty () ? qint64 (size.width ()) * size.height () * 4
+		                                                 : cache_.total_cost () / cache_.size ();
+		const qint64 pending_cost = (nb_launched + 1) * estimated_cost;
+		if (cache_.total_cost () + pending_cost > cache_.max_cost ()) {
+			qDebug () << "warmup stop (cache full)";
+			warming_up_ = false;
+			return false;
+		}
+		qDebug () << "warmup     " << render_info;
+		warmup_plan_.insert (render_info);
+		if (perform_render (render_info, RenderType::Prefetch, Priority::Background) ==
+		    Statistics::Outcome::Launched) {
+			++nb_launched;
+		} else {
+			warmup_plan_.remove (render_info);
+		}
+		return nb_launched < batch_size;
+	};
+	for (const auto & request : last_request_by_role_) {
+		if (!warming_up_ || nb_launched >= batch_size) {
+			break;
+		}
+		prefetch_strategy_->warmup (request, warmup_render);
+	}
+	if (nb_launched == 0) {
+		warming_up_ = false; // Nothing left to warm up until the next request
+	}
 }
 } // namespace Render
@@ -22,6 +22,7 @@
 #include <QPixmap>
 #include <QSize>
 #include <QStringList>
+#include <QTextStream>
 
 #include "controller.h"
 class PageInfo;
@@ -31,24 +32,31 @@ class PageInfo;
  *
  * string_to_size_in_bytes returns a negative value on error.
  */
-QString size_in_bytes_to_string (int size);
-int string_to_size_in_bytes (QString size_str);
+QString size_in_bytes_to_string (qint64 size);
+qint64 string_to_size_in_bytes (QString size_str);
 
 namespace Render {
+class Codec;
 class PrefetchStrategy;
 class SystemPrivate;
 
 /* Info represent a render metadata.
- * It is composed of a render size, and the selected page.
+ * It is composed of a render size, the selected page, and a quality level.
  * A "null" render represents invalid metadata (no page / zero size).
  *
+ * Draft renders are quick approximations, shown while the full render is running.
+ * They are never cached, and differ from full renders as hash table keys.
+ *
  * The Info constructor accept any size: it will be shrunk to the biggest fitting render size.
  * Info is comparable / hashable to enable use as a hash table key (render system cache).
  */
+enum class Quality { Full, Draft };
+
 class Info {
 private:
 	const PageInfo * page_{nullptr};
 	QSize size_{};
+	Quality quality_{Quality::Full};
 
 public:
 	Info () = default;
@@ -56,7 +64,15 @@ public:
 
 	const PageInfo * page () const noexcept { return page_; }
 	const QSize & size () const noexcept { return size_; }
+	Quality quality () const noexcept { return quality_; }
 	bool isNull () const noexcept { return page () == nullptr || size ().isNull (); }
+
+	// Same page and size, with another quality
+	Info with_quality (Quality quality) const {
+		Info info (*this);
+		info.quality_ = quality;
+		return info;
+	}
 };
 bool operator== (const Info & a, const Info & b);
 bool operator!= (const Info & a, const Info & b);
@@ -84,6 +100,51 @@ public:
 	RedrawCause cause () const noexcept { return cause_; }
 };
 
+/* Pixel format of renders stored in the cache.
+ * Full keeps the format given by poppler (32 bits per pixel).
+ * Auto chooses per render, without loss: palette (Indexed8) if it has at most 256 colours,
+ * or 24 bits per pixel if it is opaque.
+ * Lossy is like Auto, but uses 16 bits per pixel instead of 24.
+ * Renders with transparency are always stored in full.
+ */
+enum class StorageFormat { Full, Auto, Lossy };
+
+/* Configuration of the render system.
+ * 'cache_size_bytes' sets the size of the memory cache in bytes.
+ * 'codec' defines how renders are compressed in the cache, it must not be null.
+ * 'storage_format' defines the pixel format of cached renders.
+ * 'strategy' defines the prefetch strategy, it can be null (no prefetch).
+ * 'strategy_data_directory' lets the strategy keep data across runs, if not empty.
+ * Like the disk cache directory, it should be unique to the document content.
+ * 'disk_cache_directory' enables the disk cache tier if not empty.
+ * Its content is only valid for one document: it should be unique to the document content.
+ * 'max_downscale_ratio' allows creating renders by downscaling bigger cached renders.
+ * It is the maximum size ratio between source and target, and a value <= 1 disables it.
+ * 'tile_min_pixels' is the render size (in pixels) above which a render uses multiple threads.
+ * 'render_threads' is the number of render threads, with one per core if <= 0.
+ * 'hot_cache_size_bytes' sets the memory budget of ready to display pixmaps.
+ * They are kept for pages within 'hot_cache_window' pages of the current one.
+ * 'memory_budget_bytes', if positive, bounds all render memory: cache, hot pixmaps, displayed
+ * pixmaps and running renders. The cache gets what is left, up to 'cache_size_bytes'.
+ * 'adapt_to_memory_pressure' shrinks the cache while the system reports memory pressure.
+ */
+struct Options {
+	qint64 cache_size_bytes{50 * (1 << 20)}; // 50MB default
+	const Codec * codec{nullptr};
+	StorageFormat storage_format{StorageFormat::Full};
+	PrefetchStrategy * strategy{nullptr};
+	QString strategy_data_directory{};
+	QString disk_cache_directory{};
+	qint64 disk_cache_size_bytes{qint64 (1) << 30}; // 1GB default, shared by all documents
+	qreal max_downscale_ratio{2.0};
+	int tile_min_pixels{1 << 20};
+	int render_threads{0};
+	qint64 hot_cache_size_bytes{100 * (1 << 20)}; // 100MB default
+	int hot_cache_window{2};
+	qint64 memory_budget_bytes{0};
+	bool adapt_to_memory_pressure{false};
+};
+
 /* Global rendering system.
  * Classes (viewers) can request a render by signaling request_render().
  * After some time, new_render will return the requested pixmap.
@@ -91,8 +152,7 @@ public:
  *
  * Internally, the cost of rendering is reduced by caching (see render_internal.h).
  * Additionally, the pages next to the current one are pre-rendered.
- * 'cache_size_bytes' sets the size of the cache in bytes.
- * 'strategy' defines the prefetch strategy, it can be null (no prefetch).
+ * The behavior is configured by Options.
  */
 class System : public QObject {
 	Q_OBJECT
@@ -101,13 +161,21 @@ private:
 	SystemPrivate * d_; // Cleanup is done through the QObject ownership tree
 
 public:
-	System (int cache_size_bytes, PrefetchStrategy * strategy);
+	explicit System (const Options & options);
+
+	// Print statistics of caching and rendering (see Statistics)
+	void print_statistics (QTextStream & out) const;
+
+	// Abort renders and wait for all render threads. Use after the event loop has exited.
+	void shutdown ();
 
 signals:
 	void new_render (const Info & render_info, QPixmap render_data);
 
 public slots:
 	void request_render (const Request & request);
+	// Navigation to page is likely (hovered link): prefetch it for all views, before the request
+	void prefetch_page (const PageInfo * page);
 };
 
 // List of defined prefetch strategies (names)
@@ -117,6 +185,17 @@ QStringList list_of_prefetch_strategy_names ();
 PrefetchStrategy * default_prefetch_strategy ();
 PrefetchStrategy * select_prefetch_strategy_by_name (const QString & name);
 
+// List of defined cache codecs (names)
+QStringList list_of_codec_names ();
+
+// Select a Codec based on a name
+const Codec * default_codec ();
+const Codec * select_codec_by_name (const QString & name);
+
+// List of storage formats (names), and selection by name (returns false if not found)
+QStringList list_of_storage_format_names ();
+bool select_storage_format_by_name (const QString & name, StorageFormat & format);
+
 } // namespace Render
 
 Q_DECLARE_METATYPE (Render::Info);
@@ -0,0 +1,202 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "render_internal.h"
+
+namespace Render {
+
+RenderCache::RenderCache (qint64 max_cost) : max_cost_ (max_cost) {}
+
+RenderCache::~RenderCache () {
+	for (const auto & entry : entries_) {
+		delete entry.compressed;
+	}
+}
+
+const Compressed * RenderCache::find (const Info & render_info) const {
+	auto it = entries_.constFind (render_info);
+	return it != entries_.constEnd () ? it.value ().compressed : nullptr;
+}
+
+const Compressed * RenderCache::use (const Info & render_info) {
+	auto it = entries_.find (render_info);
+	if (it == entries_.end ()) {
+		return nullptr;
+	}
+	auto & entry = it.value ();
+	if (entry.is_protected) {
+		protected_.splice (protected_.end (), protected_, entry.position);
+	} else if (!entry.used) {
+		entry.used = true; // First reference: stays in probation
+	} else {
+		protected_.splice (protected_.end (), probation_, entry.position);
+		entry.is_protected = true;
+		probation_cost_ -= entry.cost;
+		counters_.promotions++;
+	}
+	return entry.compressed;
+}
+
+bool RenderCache::insert (const Info & render_info, Compressed * compressed, qint64 cost,
+                          Hint hint) {
+	remove (render_info);
+	if (cost > max_cost_) {
+		delete compressed;
+		return false;
+	}
+	if (pinned_.contains (render_info)) {
+		pin_references (*compressed);
+	}
+	make_room (cost);
+	if (!compressed->reference.isNull ()) {
+		const Compressed * reference = find (compressed->reference);
+		if (reference == nullptr || reference->id != compressed->reference_id) {
+			delete compressed;
+			return false;
+		}
+		dependents_.insert (compressed->reference, render_info);
+	}
+
+	bool is_protected = hint == Hint::Frequent;
+	if (ghost_set_.remove (render_info)) {
+		ghosts_.remove (render_info);
+		counters_.ghost_hits++;
+		is_protected = true;
+	}
+	auto & queue = is_protected ? protected_ : probation_;
+	auto position = queue.insert (queue.end (), render_info);
+	entries_.insert (render_info, Entry{compressed, cost, is_protected, false, position});
+	total_cost_ += cost;
+	if (!is_protected) {
+		probation_cost_ += cost;
+	}
+	return true;
+}
+
+void RenderCache::remove (const Info & render_info) {
+	auto it = entries_.find (render_info);
+	if (it != entries_.end ()) {
+		erase (it, false);
+	}
+}
+
+void RenderCache::set_max_cost (qint64 max_cost) {
+	max_cost_ = max_cost;
+	make_room (0);
+}
+
+void RenderCache::set_pinned (const QSet<Info> & pinned) {
+	pinned_ = pinned;
+	for (const auto & render_info : pinned) {
+		const Compressed * compressed = find (render_info);
+		if (compressed != nullptr) {
+			pin_references (*compressed);
+		}
+	}
+	make_room (0); // Renders that were only kept by pins
+}
+
+void RenderCache::pin_references (const Compressed & compressed) {
+	const Compressed * current = &compressed;
+	while (!current->reference.isNull ()) {
+		const Compressed * reference = find (current->reference);
+		if (reference == nullptr || reference->id != current->reference_id) {
+			return;
+		}
+		pinned_.insert (current->reference);
+		current = reference;
+	}
+}
+
+void RenderCache::make_room (qint64 cost) {
+	while (total_cost_ + cost > max_cost_ && !entries_.isEmpty ()) {
+		const bool probation_first =
+		    probation_cost_ > probation_share * max_cost_ || protected_.empty ();
+		auto & first = probation_first ? probation_ : protected_;
+		auto & second = probation_first ? protected_ : probation_;
+		if (!evict_oldest_unpinned (first) && !evict_oldest_unpinned (second)) {
+			return; // Only pinned renders left
+		}
+	}
+}
+
+bool RenderCache::evict_oldest_unpinned (std::list<Info> & queue) {
+	for (const auto & render_info : queue) {
+		if (pinned_.contains (render_info)) {
+			counters_.pinned_skips++;
+			continue;
+		}
+		const Info evicted = render_info; // Copy, as erase invalidates the reference
+		auto it = entries_.find (evicted);
+		if (it.value ().is_protected) {
+			counters_.protected_evictions++;
+		} else {
+			counters_.probation_evictions++;
+			ghosts_.push_back (evicted);
+			ghost_set_.insert (evicted);
+			if (ghosts_.size () > static_cast<std::size_t> (max_ghosts)) {
+				ghost_set_.remove (ghosts_.front ());
+				ghosts_.pop_front ();
+			}
+		}
+		counters_.evicted_bytes += it.value ().cost;
+		erase (it, true);
+		if (on_eviction_) {
+			on_eviction_ (evicted);
+		}
+		return true;
+	}
+	return false;
+}
+
+void RenderCache::erase (QHash<Info, Entry>::iterator it, bool is_eviction) {
+	const Info render_info = it.key (); // Copies, as erase invalidates the iterator
+	const auto & entry = it.value ();
+	const quint64 id = entry.compressed->id;
+	if (!entry.compressed->reference.isNull ()) {
+		dependents_.remove (entry.compressed->reference, render_info);
+	}
+	total_cost_ -= entry.cost;
+	if (entry.is_protected) {
+		protected_.erase (entry.position);
+	} else {
+		probation_cost_ -= entry.cost;
+		probation_.erase (entry.position);
+	}
+	delete entry.compressed;
+	entries_.erase (it);
+
+	// Renders delta encoded against this one are unusable now
+	const auto dependents = dependents_.values (render_info);
+	dependents_.remove (render_info);
+	for (const auto & dependent : dependents) {
+		auto dependent_it = entries_.find (dependent);
+		if (dependent_it == entries_.end () ||
+		    dependent_it.value ().compressed->reference_id != id) {
+			continue;
+		}
+		if (is_eviction) {
+			counters_.dependent_evictions++;
+			counters_.evicted_bytes += dependent_it.value ().cost;
+		}
+		erase (dependent_it, is_eviction);
+		if (is_eviction && on_eviction_) {
+			on_eviction_ (dependent);
+		}
+	}
+}
+
+} // namespace Render
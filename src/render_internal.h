@@ -16,16 +16,30 @@
  */
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
 #include <utility>
 
 #include <QByteArray>
-#include <QCache>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QImage>
+#include <QMultiMap>
+#include <QMutex>
 #include <QPixmap>
 #include <QRunnable>
+#include <QSet>
+#include <QThreadPool>
+#include <QString>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
 
 #include "render.h"
+#include "trace.h"
 
 /* Internal header of the rendering system.
  * Header is required for moc to process Task/SystemPrivate classes.
@@ -37,63 +51,516 @@
  *
  * In PDFTalk, window sizes are expected to change from program launch to presentation running.
  * No total prerendering is done.
- * Instead we use a LRU cache (bounded by a memory usage) of renders (indexed by page x size).
+ * Instead we use a cache (bounded by a memory usage) of renders (indexed by page x size).
+ * Its eviction policy (RenderCache) favors renders used more than once, and keeps the prefetch
+ * window.
  * Rendering is done on demand (when pages are requested).
- * When a page is rendered (QImage), we store a qCompressed version in the cache (Compressed).
+ * When a page is rendered (QImage), we store a compressed version in the cache (Compressed).
+ * Compression is delegated to a Codec class (zlib, lz4, raw), selected at startup.
  * Page requests are fulfilled from the Compressed if available, or from a render.
+ * An optional second tier on disk (DiskCache) keeps renders across program restarts.
  *
  * Pre rendering is delegated to a PrefetchStrategy class.
  * This class decides which pages to render based on the context from a Request.
  */
 namespace Render {
 
-// Stores data for a Compressed render
+/* Codec interface.
+ * Has a name for commandline identification.
+ * Codecs transform raw image bytes to and from the cache representation.
+ * They are used concurrently by render threads and must be stateless.
+ * uncompress writes the 'size' decoded bytes to output, and returns false if data does not decode
+ * to exactly 'size' bytes.
+ * Codecs with data_is_pixels store the pixels as is, so images can share the cached data.
+ */
+class Codec {
+private:
+	QString name_;
+
+public:
+	Codec (const QString & name);
+	virtual ~Codec () = default;
+	const QString & name () const noexcept { return name_; }
+	virtual QByteArray compress (const uchar * data, int size) const = 0;
+	virtual bool uncompress (const QByteArray & data, uchar * output, int size) const = 0;
+	virtual bool data_is_pixels () const { return false; }
+};
+
+/* Pool of large buffers, for image pixels and temporary render buffers.
+ * Renders are several megabytes: allocating them each time means mmap / munmap calls and page
+ * faults on every render or cache hit. Buffers are instead kept for reuse when released.
+ *
+ * Buffers are grouped in size classes: 4 per power of two, so at most 20% of a buffer is unused.
+ * Released buffers are kept up to max_free_bytes in total, and freed by trim.
+ * Buffers of pooled images go back to the pool through the QImage cleanup function.
+ * A single instance is shared by all threads, and is thread safe.
+ */
+class BufferPool {
+public:
+	struct Counters {
+		quint64 acquired{0};
+		quint64 reused{0}; // Acquired from a released buffer
+		qint64 allocated_bytes{0}; // In use or free
+		qint64 free_bytes{0};
+	};
+
+private:
+	static constexpr qint64 min_buffer_bytes = 1 << 16;
+	static constexpr int classes_per_power_of_two = 4;
+
+	qint64 max_free_bytes_;
+	mutable QMutex mutex_;
+	QHash<qint64, QVector<uchar *>> free_buffers_; // By capacity
+	Counters counters_;
+
+public:
+	explicit BufferPool (qint64 max_free_bytes);
+	~BufferPool ();
+	BufferPool (const BufferPool &) = delete;
+	BufferPool & operator= (const BufferPool &) = delete;
+
+	static BufferPool & instance ();
+
+	// Buffer of at least size bytes, or nullptr if allocation failed
+	uchar * acquire (qint64 size);
+	void release (uchar * buffer);
+	// Free all released buffers (under memory pressure)
+	void trim ();
+
+	Counters counters () const;
+};
+
+// Buffer from the pool for scoped use
+struct PooledBufferDeleter {
+	void operator() (uchar * buffer) const { BufferPool::instance ().release (buffer); }
+};
+using PooledBuffer = std::unique_ptr<uchar[], PooledBufferDeleter>;
+
+/* Image using a buffer from the pool, returned to the pool when the image data is destroyed.
+ * Pixels are uninitialized. Default bytes_per_line is the one of the QImage constructor.
+ * Returns a null image on failure.
+ */
+QImage make_pooled_image (const QSize & size, QImage::Format format);
+QImage make_pooled_image (const QSize & size, int bytes_per_line, QImage::Format format);
+
+/* Stores data for a Compressed render, and which codec was used.
+ * The image may be in a reduced format (see StorageFormat).
+ * color_table is only used by palette (Indexed8) images.
+ *
+ * Pages of the same slide (overlays) are often almost identical.
+ * Such a render can be delta encoded: data is then the XOR of its pixels with those of a reference
+ * render of the same size and format, usually the previous page.
+ * The reference is identified by its Info, and by its id as the cache entry may be replaced.
+ * Ids are given by the render system when inserting in the cache (0 if not inserted).
+ */
 struct Compressed {
 	QByteArray data;
 	QSize size;
 	int bytes_per_line;
 	QImage::Format image_format;
+	const Codec * codec;
+	QVector<QRgb> color_table;
+	quint64 id;
+	Info reference; // Null if not delta encoded
+	quint64 reference_id;
+};
+
+/* Copies of the references needed to decode a delta encoded render.
+ * The first element is its reference, then the reference of the reference, and so on.
+ * The last element is not delta encoded.
+ * Copies are cheap (implicitly shared data), and can be used by render threads.
+ */
+using ReferenceChain = QVector<Compressed>;
+
+// Reference proposed to delta encode a new render. Not used if the chain is empty.
+struct DeltaReference {
+	Info info;
+	ReferenceChain chain;
+};
+
+/* Disk tier of the render cache.
+ * Compressed renders are stored as files in a directory specific to the document content.
+ * Files are named from the page index and render size, and contain the codec name.
+ * A pdf file change leads to a different directory, so entries never need invalidation.
+ *
+ * The disk cache is write-through: every new render is stored.
+ * Thus renders evicted from the memory cache can be recovered from disk.
+ * Methods are called from render threads, and only read immutable state (and an atomic counter).
+ * Files are written atomically, so concurrent readers never see partial files.
+ * Only renders which are not delta encoded can be stored.
+ *
+ * The parent directory is shared by all documents, and each edit of a document creates a new
+ * directory. All entries are bounded by max_total_bytes: at creation, the least recently
+ * written entries of all directories are removed down to 3/4 of the bound, with empty
+ * directories. During the run, renders are not stored anymore once the bound is reached.
+ */
+class DiskCache {
+private:
+	QString directory_;
+	qint64 max_total_bytes_;
+	mutable std::atomic<qint64> total_bytes_{0};
+
+public:
+	DiskCache (const QString & directory, qint64 max_total_bytes);
+
+	// Cheap test for an entry, which may still be unusable
+	bool contains (const Info & render_info) const;
+	// Returns false if there is no usable entry
+	bool load (const Info & render_info, Compressed & compressed) const;
+	void store (const Info & render_info, const Compressed & compressed) const;
+
+private:
+	QString entry_path (const Info & render_info) const;
+	void prune ();
+};
+
+/* Immutable parameters of renders, shared by the render system and its tasks.
+ * The disk cache is shared as tasks may still run while the render system is destroyed.
+ * Renders with more than tile_min_pixels pixels are split in tiles rendered in parallel.
+ */
+struct RenderParameters {
+	const Codec * codec;
+	StorageFormat storage_format;
+	std::shared_ptr<const DiskCache> disk_cache; // Optional
+	int tile_min_pixels;                         // 0 disables tiling
 };
 
+/* Flag used to abort a render.
+ * Set by the render system (GUI thread), polled by render threads during the render.
+ */
+using AbortFlag = std::shared_ptr<std::atomic<bool>>;
+
+// Arguments of trace events for a render
+Trace::Args trace_args (const Info & render_info);
+
 /* Renders the page at the selected size.
+ * Big renders are split in horizontal tiles, rendered in parallel, then stitched together.
  * Returns both the pixmap and a Compressed version.
  * The pixmap can be given to the requesting view.
  * The Compressed version can be stored in the render cache.
+ * If the render has been aborted, returns {nullptr, QPixmap ()}.
+ * The Compressed version is delta encoded against the given reference if it is smaller.
+ * partial_update, if defined, receives partially rendered images (see PageInfo::render).
  *
  * Compressed renders are transmitted as owning raw pointers.
  * Signals cannot handle unique_ptr<Compressed> (move only unsupported).
- * And QCache requires an 'operator new' allocated object.
+ * And RenderCache requires an 'operator new' allocated object.
  */
-std::pair<Compressed *, QPixmap> make_render (const Info & render_info);
+std::pair<Compressed *, QPixmap>
+make_render (const Info & render_info, const RenderParameters & parameters,
+             const std::function<bool()> & should_abort, const DeltaReference & delta_reference,
+             const std::function<void(const QImage &)> & partial_update =
+                 std::function<void(const QImage &)> ());
 
-/* Recreate a pixmap from a Compressed render.
+/* Make a render by downscaling a bigger render of the same page.
+ * Much cheaper than rendering with poppler, at the cost of slightly blurrier text.
+ * Falls back to make_render if the source cannot be decompressed.
  */
-QPixmap make_pixmap_from_compressed_render (const Compressed & render);
+std::pair<Compressed *, QPixmap>
+make_downscaled_render (const Info & render_info, const Compressed & source,
+                        const ReferenceChain & source_references,
+                        const RenderParameters & parameters,
+                        const std::function<bool()> & should_abort,
+                        const DeltaReference & delta_reference);
 
-// "Render a page" task for QThreadPool.
+/* Make a draft of a render: quick and approximate, for display only.
+ * Scales the source (a cached render of the same page at another size) if given and decodable.
+ * Otherwise renders the page at a lower resolution, and upscales it.
+ * Returns a null pixmap if aborted.
+ */
+QPixmap make_draft_render (const Info & render_info, const Compressed * source,
+                           const ReferenceChain & source_references,
+                           const std::function<bool()> & should_abort);
+
+/* Recreate an image or pixmap from a Compressed render, using the codec stored in the render.
+ * Delta encoded renders also require the chain of their references.
+ * Returns a null image / pixmap if decompression failed.
+ */
+QImage make_image_from_compressed_render (const Compressed & render,
+                                          const ReferenceChain & references = ReferenceChain ());
+QPixmap make_pixmap_from_compressed_render (const Compressed & render,
+                                            const ReferenceChain & references = ReferenceChain ());
+
+/* "Render a page" task for QThreadPool.
+ * If a downscale source is set, the render is made from it instead of poppler.
+ * Otherwise, if a disk cache is given, try loading the render from it first.
+ * In this case the pixmap is only generated (decoded) for requested tasks, and null otherwise.
+ * Draft renders only generate a pixmap (null compressed pointer), using the downscale source
+ * as draft source if set.
+ * Poppler renders of requested tasks also signal partially rendered images (throttled).
+ * They are signaled as images, and only converted to pixmaps if shown.
+ * With a decode source (cache hit), the task only decodes it, and signals finished_decoding.
+ * A decode failure is signaled with a null pixmap, and an aborted decode signals nothing.
+ *
+ * The render stops as soon as possible if the abort flag is set (even before starting).
+ * An aborted render is signaled with a null compressed pointer and a null pixmap.
+ * A failed render (not aborted) is signaled by failed_rendering.
+ * from_disk tells if the render was loaded from the disk cache instead of rendered.
+ */
 class Task : public QObject, public QRunnable {
 	Q_OBJECT
 
 private:
 	const Info render_info_;
+	const RenderParameters parameters_;
+	const AbortFlag abort_flag_;
+	std::unique_ptr<Compressed> downscale_source_;
+	ReferenceChain downscale_source_references_;
+	DeltaReference delta_reference_;
+	bool decode_only_{false};
+	bool requested_{false};
+	qint64 queued_at_; // For tracing
 
 public:
-	Task (const Info & render_info) : render_info_ (render_info) {}
+	Task (const Info & render_info, const RenderParameters & parameters,
+	      const AbortFlag & abort_flag)
+	    : render_info_ (render_info),
+	      parameters_ (parameters),
+	      abort_flag_ (abort_flag),
+	      queued_at_ (Trace::now ()) {}
+
+	void set_downscale_source (const Compressed & source, const ReferenceChain & references);
+	void set_decode_source (const Compressed & source, const ReferenceChain & references);
+	void set_delta_reference (const DeltaReference & delta_reference);
+	void set_requested (); // Render requested at launch, not a prefetch
 
 signals:
 	// "Render::Info" as Qt is not very namespace friendly
-	void finished_rendering (Render::Info render_info, Compressed * compressed, QPixmap pixmap);
+	void finished_rendering (Render::Info render_info, Compressed * compressed, QPixmap pixmap,
+	                         bool from_disk);
+	void failed_rendering (Render::Info render_info);
+	void partial_rendering (Render::Info render_info, QImage image);
+	void finished_decoding (Render::Info render_info, QPixmap pixmap);
+
+public:
+	void run () Q_DECL_FINAL;
+};
+
+/* Priority scheduler for render tasks, with a dedicated thread pool.
+ * Tasks are queued by priority (FIFO for equal priorities), and owned by the scheduler.
+ * Queued tasks are identified by the id returned by start.
+ * They can be reprioritized or cancelled while not started, which returns false otherwise.
+ *
+ * A pool runnable is started for each task, and takes the best queued task when it starts.
+ * Thus priorities of queued tasks can change after submission to the pool.
+ */
+class Scheduler {
+public:
+	// Priority classes, in increasing order
+	enum class Priority { Background, FarPrefetch, NearPrefetch, Anticipated, Requested };
+
+private:
+	class Worker;
+	struct QueuedTask {
+		quint64 id;
+		Task * task;
+	};
+
+	QThreadPool pool_;
+	mutable QMutex mutex_;
+	QMultiMap<Priority, QueuedTask> queue_;
+	quint64 next_id_{0};
 
 public:
-	void run () Q_DECL_FINAL {
-		auto result = make_render (render_info_);
-		emit finished_rendering (render_info_, result.first, result.second);
+	explicit Scheduler (int nb_threads); // <= 0: one per core
+	~Scheduler ();
+
+	quint64 start (Task * task, Priority priority);
+	bool set_priority (quint64 id, Priority priority);
+	bool cancel (quint64 id);
+	void clear (); // Cancel all queued tasks
+	void wait_for_done ();
+	int nb_queued () const;
+	int nb_threads () const { return pool_.maxThreadCount (); }
+
+private:
+	Task * take_next ();
+};
+
+/* Main render cache: Compressed renders, bounded by a total cost (bytes).
+ * Replaces QCache, whose pure LRU policy lets a scan of new pages (a long backward excursion,
+ * a jump to the appendix) evict the whole useful set.
+ *
+ * Eviction follows a 2Q policy, which is scan resistant:
+ * - new renders enter the probation queue (FIFO);
+ * - a render used twice (use, not find) moves to the protected queue (LRU);
+ *   a render inserted for a request must be used right away, which counts as its first use.
+ * - renders evicted from probation are remembered as ghosts (keys only, bounded count);
+ *   a ghost render inserted again goes directly in the protected queue.
+ * Probation is evicted first while it uses more than probation_share of the budget.
+ * Thus renders seen once cannot evict renders used twice beyond that share.
+ * Prefetch lookups must use find: a prefetched render shown once stays in probation, like the
+ * pages of a long backward excursion, while the prefetched upcoming pages are not evicted first.
+ *
+ * Pinned renders are never evicted (current prefetch window).
+ * The references of pinned delta encoded renders are pinned too, as they cannot be used without.
+ * For the same reason, removing or evicting a render also removes the renders delta encoded
+ * against it, and a render is not inserted if its reference is missing.
+ * If only pinned renders are left, the cache stays over budget until pins change.
+ * Hints given at insertion adjust the policy: Frequent renders go directly to protected.
+ * Eviction counters are exposed for tuning, and an eviction callback can be set.
+ * Owns the Compressed objects. Used in the GUI thread only.
+ */
+class RenderCache {
+public:
+	enum class Hint { Normal, Frequent };
+
+	struct Counters {
+		int probation_evictions;
+		int protected_evictions;
+		qint64 evicted_bytes;
+		int promotions;   // probation -> protected
+		int ghost_hits;   // inserted in protected thanks to a ghost
+		int pinned_skips; // pinned renders skipped when looking for a victim
+		int dependent_evictions; // delta encoded renders evicted with their reference
+	};
+
+private:
+	static constexpr qreal probation_share = 0.25;
+	static constexpr int max_ghosts = 512;
+
+	struct Entry {
+		Compressed * compressed;
+		qint64 cost;
+		bool is_protected;
+		bool used; // Used once in probation
+		std::list<Info>::iterator position; // In its queue
+	};
+	QHash<Info, Entry> entries_;
+	std::list<Info> probation_; // Oldest first
+	std::list<Info> protected_; // Least recently used first
+	std::list<Info> ghosts_;    // Oldest first
+	QSet<Info> ghost_set_;
+	QSet<Info> pinned_;
+	QMultiHash<Info, Info> dependents_; // Reference -> delta encoded renders
+
+	qint64 max_cost_;
+	qint64 total_cost_{0};
+	qint64 probation_cost_{0};
+	Counters counters_{};
+	std::function<void(const Info &)> on_eviction_;
+
+public:
+	explicit RenderCache (qint64 max_cost);
+	~RenderCache ();
+	RenderCache (const RenderCache &) = delete;
+	RenderCache & operator= (const RenderCache &) = delete;
+
+	qint64 total_cost () const { return total_cost_; }
+	qint64 max_cost () const { return max_cost_; }
+	int size () const { return entries_.size (); }
+	bool is_empty () const { return entries_.isEmpty (); }
+	bool contains (const Info & render_info) const { return entries_.contains (render_info); }
+	QList<Info> keys () const { return entries_.keys (); }
+	const Counters & counters () const { return counters_; }
+
+	// Lookup, without effect on eviction. nullptr if absent.
+	const Compressed * find (const Info & render_info) const;
+	// Lookup of a render being used (served). Protects it from eviction at the second use.
+	const Compressed * use (const Info & render_info);
+
+	// Takes ownership. Returns false (and deletes compressed) if cost is above max_cost, or if the
+	// reference of a delta encoded render is missing (or has been evicted to make room).
+	bool insert (const Info & render_info, Compressed * compressed, qint64 cost,
+	             Hint hint = Hint::Normal);
+	void remove (const Info & render_info);
+	void set_max_cost (qint64 max_cost); // Evicts renders if needed
+
+	void set_pinned (const QSet<Info> & pinned);
+	// Called for each evicted render (not for remove), after its removal
+	void set_eviction_callback (const std::function<void(const Info &)> & callback) {
+		on_eviction_ = callback;
 	}
+
+private:
+	void make_room (qint64 cost);
+	void pin_references (const Compressed & compressed);
+	bool evict_oldest_unpinned (std::list<Info> & queue);
+	void erase (QHash<Info, Entry>::iterator it, bool is_eviction);
+};
+
+/* Hot tier of the render cache: ready to display pixmaps, for pages near the current page.
+ * Pixmaps are kept if their page index is within 'window' pages of the current page.
+ * Total size is bounded by a budget in bytes, evicting pixmaps of the farthest pages first.
+ * Pixmaps are stored after their Compressed version has been put in the main cache.
+ * Thus pixmaps leaving the window (demotion) are just dropped.
+ * Used in the GUI thread only (QPixmap).
+ */
+class HotCache {
+private:
+	QHash<Info, QPixmap> pixmaps_;
+	qint64 max_bytes_;
+	int window_;
+	qint64 total_bytes_{0};
+	int current_page_index_{0};
+
+public:
+	HotCache (qint64 max_bytes, int window);
+
+	bool enabled () const { return max_bytes_ > 0 && window_ >= 0; }
+	qint64 total_bytes () const { return total_bytes_; }
+	qint64 max_bytes () const { return max_bytes_; }
+
+	QPixmap find (const Info & render_info) const; // Null pixmap if absent
+	void insert (const Info & render_info, const QPixmap & pixmap);
+	void set_current_page (int page_index); // Drops pixmaps outside the new window
+
+private:
+	bool in_window (const Info & render_info) const;
+	int distance (const Info & render_info) const;
+	QHash<Info, QPixmap>::iterator remove (QHash<Info, QPixmap>::iterator it);
+};
+
+/* Statistics of the render system, to evaluate caching and prefetch settings.
+ *
+ * Requests are counted per view role, by outcome:
+ * served from the hot cache, the main cache, by joining a running render, or by a new render.
+ * Prefetched renders are useful if requested later, or wasted if evicted before.
+ * Request latency is the time from the request to the emission of the pixmap.
+ * Compression ratios are relative to the 32 bit per pixel image.
+ * Used in the GUI thread only.
+ */
+class Statistics {
+public:
+	enum class Outcome { Ignored, Hot, Cached, Running, Launched };
+
+private:
+	static constexpr int nb_outcomes = static_cast<int> (Outcome::Launched) + 1;
+	QHash<ViewRole, std::array<int, nb_outcomes>> requests_by_role_;
+
+	int prefetch_renders_{0};
+	int prefetch_used_{0};
+	int prefetch_evicted_{0};
+	QSet<Info> unused_prefetch_renders_;
+
+	QElapsedTimer clock_;
+	QHash<Info, qint64> pending_requests_; // Request time (µs)
+	QVector<qint64> request_latencies_;    // µs
+
+	qint64 uncompressed_bytes_{0};
+	qint64 compressed_bytes_{0};
+	int nb_compressed_{0};
+	int nb_delta_encoded_{0};
+
+public:
+	Statistics ();
+
+	void request_started (const Info & render_info);
+	void request (const Info & render_info, ViewRole role, Outcome outcome);
+	void request_served (const Info & render_info);
+	void prefetch_render_finished (const Info & render_info);
+	void prefetch_render_used (const Info & render_info);
+	void prefetch_render_joined (); // Requested while running as a prefetch
+	void render_evicted (const Info & render_info);
+	void compressed_stored (const Compressed & compressed);
+
+	void print (QTextStream & out) const;
 };
 
 /* Caching system (internals).
  * Stores compressed renders in a cache to avoid rerendering stuff later.
- * Rendering is done through Tasks in a QThreadPool.
+ * Pixmaps for pages near the current one are also kept in a HotCache in front of it.
+ * Rendering is done through Tasks in a Scheduler.
  *
  * Render requests arrive at request_render slot.
  * They are either served from the cache, or a render is launched.
@@ -104,32 +571,147 @@ public:
  * Prefetch renders emit no signal, and only update the cache.
  * If a render is requested while it is running, its status is updated to requested.
  * being_rendered tracks running renders, preventing double rendering and keeping their status.
+ *
+ * Running renders are aborted when they are not wanted anymore (fast navigation, resizes).
+ * A render is wanted if it is the last requested render of a view role,
+ * or part of the prefetch plan (prefetched renders) of the last request of a view role.
+ * Wanted renders (except warmup) are pinned in the cache: they are never evicted.
+ * Aborted renders are untracked immediately: a new request will start a new render.
+ * Results from aborted renders that completed anyway are still put in the cache.
+ * Renders that have not started yet are simply removed from the scheduler queue.
+ *
+ * Renders are scheduled by priority: requested, then near prefetch, then far prefetch.
+ * Prefetch renders are near if they are next to the page of the request which triggered them.
+ * If a render is requested (or prefetched closer) while queued, its priority is raised.
+ *
+ * A page can be anticipated before any request (prefetch_page, when a link is hovered).
+ * Its renders for the last request of each role are prefetched above other prefetch renders.
+ * They stay wanted until the next request or anticipated page.
+ *
+ * Memory: the cache is bounded by cache_size_bytes.
+ * With a memory budget, it is also bounded by what the rest of render memory leaves:
+ * hot pixmaps, displayed pixmaps (if not hot) and running renders (uncompressed images).
+ * The cache bound is updated after each request and finished render.
+ * If adapting to memory pressure, the system is polled every memory_pressure_poll_ms.
+ * Under pressure, the cache bound is halved at each poll (down to 1/16), and doubled back after.
+ *
+ * Idle warmup: when no render has been running for idle_warmup_delay_ms, the prefetch strategy
+ * is asked for warmup renders for the last request of each role (background priority).
+ * They are launched in batches of one per render thread, the next batch when a batch finishes.
+ * Warmup stops at the first new request (its renders are unwanted and aborted), when the
+ * strategy has nothing left to warm up, or if the next render would not fit in the cache.
+ * Thus warmup never evicts renders from the cache, in particular those near the current page.
+ *
+ * A requested render which is not downscaled is preceded by a draft render, if it is big.
+ * The draft is made from the biggest cached render of the page, or at a lower resolution.
+ * It is shown only if the full render is still running when the draft finishes.
+ * Requested renders also send partially rendered images, shown as drafts until a real draft
+ * has been shown.
+ *
+ * Requested cache hits are decoded by Tasks in decode_pool_, not in the GUI thread.
+ * Thus the decodes of the views updated by one page change run in parallel.
+ * They use a pool separate from the scheduler, to not wait behind running renders.
+ * Decodes are tracked in being_rendered_ like renders: later requests join them, and they are
+ * aborted if unwanted. An entry found corrupted when decoded is removed and rendered again.
+ *
+ * Views of the same page at different sizes are common (presenter / public views, resizes).
+ * A missing render can be made by downscaling a bigger cached render of the same page.
+ * The size ratio is limited by max_downscale_ratio, as quality degrades with the ratio.
+ *
+ * New renders of a page are delta encoded against the cached render of the previous page of the
+ * same slide, if present at the same size (see Compressed).
+ * Reference chains are bounded (max_delta_chain_length), to bound decoding costs.
+ * A delta encoded entry is usable while all its references are still in the cache.
+ * Otherwise it is removed when found unusable, and rendered again.
  */
 class SystemPrivate : public QObject {
 	Q_OBJECT
 
 private:
 	System * parent_;
-	QCache<Info, Compressed> cache_;
+	HotCache hot_cache_;
+	RenderCache cache_;
+	const qint64 cache_size_bytes_;
+	const qint64 memory_budget_bytes_;
+	static constexpr int memory_pressure_poll_ms = 2000;
+	QTimer memory_pressure_timer_;
+	int pressure_shrink_shift_{0}; // Cache bound is divided by 2^shift
+	Statistics statistics_;
+	quint64 last_compressed_id_{0};
+	const RenderParameters render_parameters_;
+	qreal max_downscale_ratio_;
+
+	Scheduler scheduler_;
+	QThreadPool decode_pool_;
 
 	enum class RenderType { Requested, Prefetch };
-	QHash<Info, RenderType> being_rendered_;
+	using Priority = Scheduler::Priority;
+	struct RunningRender {
+		RenderType type;
+		Priority priority;
+		AbortFlag abort_flag;
+		quint64 task_id; // Unused for decodes, which are not in the scheduler
+		bool draft_shown;
+		bool decode;
+	};
+	QHash<Info, RunningRender> being_rendered_;
+
+	QHash<ViewRole, Info> requested_by_role_;
+	QHash<ViewRole, QSet<Info>> prefetch_plan_by_role_;
+	QHash<ViewRole, Request> last_request_by_role_;
+	// Context of the prefetch strategy call
+	QSet<Info> * current_prefetch_plan_{nullptr};
+	int current_prefetch_origin_{-1}; // Page index of the request
 
 	PrefetchStrategy * prefetch_strategy_;
 	std::function<void(const Info &)> prefetch_render_lambda_; // for PrefetchStrategy, cached
 
+	static constexpr int idle_warmup_delay_ms = 1000;
+	QTimer idle_timer_;
+	bool warming_up_{false};
+	QSet<Info> warmup_plan_;
+
+	QSet<Info> anticipated_plan_;
+
+	QSet<Info> rerendered_after_decode_failure_; // Bounds re-renders of undecodable renders
+
 public:
-	SystemPrivate (int cache_size_bytes, PrefetchStrategy * strategy, System * parent);
+	SystemPrivate (const Options & options, System * parent);
 	~SystemPrivate ();
 
 	void request_render (const Request & request);
+	void prefetch_page (const PageInfo * page);
+	void print_statistics (QTextStream & out) const;
+	void shutdown ();
 
 private slots:
 	// "Render::Info" as Qt is not very namespace friendly
-	void rendering_finished (Render::Info render_info, Compressed * compressed, QPixmap pixmap);
+	void rendering_finished (Render::Info render_info, Compressed * compressed, QPixmap pixmap,
+	                         bool from_disk);
+	void rendering_failed (Render::Info render_info);
+	void partial_rendering (Render::Info render_info, QImage image);
+	void decoding_finished (Render::Info render_info, QPixmap pixmap);
+	void idle_timeout ();
+	void check_memory_pressure ();
 
 private:
-	void perform_render (const Info & render_info, RenderType type);
+	Statistics::Outcome perform_render (const Info & render_info, RenderType type,
+	                                    Priority priority);
+	void launch_decode (const Info & render_info, const Compressed & compressed,
+	                    const ReferenceChain & references);
+	void launch_draft_render (const Info & render_info);
+	void cancel_draft_render (const Info & render_info); // When the full render is finished
+	const Compressed * find_downscale_source (const Info & render_info);
+	void insert_in_cache (const Info & render_info, Compressed * compressed);
+	bool is_cached (const Info & render_info); // With its references
+	bool find_reference_chain (const Compressed & render, ReferenceChain & references);
+	DeltaReference find_delta_reference (const Info & render_info);
+	bool is_wanted (const Info & render_info) const;
+	void abort_unwanted_renders ();
+	void update_pinned_renders ();
+	void update_cache_budget ();
+	void on_idle ();
+	void launch_warmup_batch ();
 };
 
 /* Prefetch strategy interface.
@@ -137,6 +719,19 @@ private:
  * Strategies must implement the prefetch method.
  * The context determines which pages will be pre rendered using pre_render.
  * pre_render should do nothing if the render is cached.
+ *
+ * warmup is called when the render system is idle, with the last request of a view role.
+ * It should give renders in decreasing order of usefulness to warmup_render, while it returns true.
+ * Cached renders are skipped by warmup_render, so the same renders can be given at each call.
+ * By default, strategies do no warmup.
+ *
+ * cache_hint is called when a render is stored in the cache, to adjust its eviction.
+ *
+ * anticipates tells if hovered link targets should be prefetched (see System::prefetch_page).
+ *
+ * start and stop are called when the render system starts and stops using the strategy.
+ * Strategies can persist data across runs in data_directory, which is specific to the document.
+ * It is empty if persistence is disabled.
  */
 class PrefetchStrategy {
 private:
@@ -146,7 +741,19 @@ public:
 	PrefetchStrategy (const QString & name);
 	virtual ~PrefetchStrategy () = default;
 	const QString & name () const noexcept { return name_; }
+	virtual void start (const QString & data_directory) { Q_UNUSED (data_directory); }
+	virtual void stop () {}
 	virtual void prefetch (const Request & context,
 	                       const std::function<void(const Info &)> & request_render) = 0;
+	virtual void warmup (const Request & context,
+	                     const std::function<bool(const Info &)> & warmup_render) {
+		Q_UNUSED (context);
+		Q_UNUSED (warmup_render);
+	}
+	virtual RenderCache::Hint cache_hint (const Info & render_info) const {
+		Q_UNUSED (render_info);
+		return RenderCache::Hint::Normal;
+	}
+	virtual bool anticipates () const { return true; }
 };
 } // namespace Render
@@ -0,0 +1,127 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <iterator>
+
+#include <QMutexLocker>
+#include <QThread>
+
+#include "render_internal.h"
+
+namespace Render {
+
+/* Pool runnable.
+ * One is started for each queued task, but it runs the best task at the time it starts.
+ * If the queue is empty (cancelled tasks), it does nothing.
+ */
+class Scheduler::Worker : public QRunnable {
+private:
+	Scheduler & scheduler_;
+
+public:
+	explicit Worker (Scheduler & scheduler) : scheduler_ (scheduler) {}
+
+	void run () Q_DECL_FINAL {
+		std::unique_ptr<Task> task{scheduler_.take_next ()};
+		if (task) {
+			task->run ();
+		}
+	}
+};
+
+Scheduler::Scheduler (int nb_threads) {
+	if (nb_threads <= 0) {
+		nb_threads = QThread::idealThreadCount ();
+	}
+	pool_.setMaxThreadCount (nb_threads);
+	pool_.setExpiryTimeout (-1); // Keep threads, and their thread-local data
+}
+
+Scheduler::~Scheduler () {
+	clear ();
+	pool_.waitForDone ();
+}
+
+quint64 Scheduler::start (Task * task, Priority priority) {
+	Q_ASSERT (task != nullptr);
+	task->setAutoDelete (false); // Owned by the scheduler, then the Worker
+	quint64 id;
+	{
+		QMutexLocker lock (&mutex_);
+		id = next_id_++;
+		queue_.insert (priority, QueuedTask{id, task});
+	}
+	pool_.start (new Worker (*this));
+	return id;
+}
+
+bool Scheduler::set_priority (quint64 id, Priority priority) {
+	QMutexLocker lock (&mutex_);
+	for (auto it = queue_.begin (); it != queue_.end (); ++it) {
+		if (it.value ().id == id) {
+			if (it.key () != priority) {
+				auto queued = it.value ();
+				queue_.erase (it);
+				queue_.insert (priority, queued);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Scheduler::cancel (quint64 id) {
+	QMutexLocker lock (&mutex_);
+	for (auto it = queue_.begin (); it != queue_.end (); ++it) {
+		if (it.value ().id == id) {
+			delete it.value ().task;
+			queue_.erase (it);
+			return true;
+		}
+	}
+	return false;
+}
+
+void Scheduler::clear () {
+	QMutexLocker lock (&mutex_);
+	for (const auto & queued : queue_) {
+		delete queued.task;
+	}
+	queue_.clear ();
+}
+
+void Scheduler::wait_for_done () {
+	pool_.waitForDone ();
+}
+
+int Scheduler::nb_queued () const {
+	QMutexLocker lock (&mutex_);
+	return queue_.size ();
+}
+
+Task * Scheduler::take_next () {
+	// Highest priority is last. For equal keys QMultiMap stores the most recent first: FIFO.
+	QMutexLocker lock (&mutex_);
+	if (queue_.isEmpty ()) {
+		return nullptr;
+	}
+	auto last = std::prev (queue_.end ());
+	auto * task = last.value ().task;
+	queue_.erase (last);
+	return task;
+}
+
+} // namespace Render
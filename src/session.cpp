@@ -0,0 +1,96 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QCoreApplication>
+
+#include "document.h"
+#include "render.h"
+#include "session.h"
+
+static constexpr int session_format_version = 1;
+
+SessionRecorder::SessionRecorder (const QString & filename, QObject * parent)
+    : QObject (parent), file_ (filename) {}
+
+SessionRecorder * SessionRecorder::open (const QString & filename, const Document & document,
+                                         QObject * parent) {
+	auto * recorder = new SessionRecorder (filename, parent);
+	if (!recorder->file_.open (QFile::WriteOnly | QFile::Truncate | QFile::Text)) {
+		QTextStream (stderr) << tr ("Error: unable to write session to \"%1\"\n").arg (filename);
+		delete recorder;
+		return nullptr;
+	}
+	recorder->stream_.setDevice (&recorder->file_);
+	recorder->stream_ << "pdftalk-session " << session_format_version << ' '
+	                  << QString::fromLatin1 (document.content_hash ()) << '\n';
+	recorder->stream_.flush ();
+	recorder->clock_.start ();
+	return recorder;
+}
+
+void SessionRecorder::record_request (const Render::Request & request) {
+	// Flushed for each event: events are rare, and the log survives crashes
+	stream_ << clock_.elapsed () << ' ' << request.current_page ()->index () << ' '
+	        << static_cast<int> (request.role ()) << ' ' << static_cast<int> (request.cause ()) << ' '
+	        << request.box_size ().width () << ' ' << request.box_size ().height () << '\n';
+	stream_.flush ();
+}
+
+bool read_session (const QString & filename, const Document & document,
+                   std::vector<SessionEvent> & events) {
+	auto tr = [](const char * str) { return qApp->translate ("read_session", str); };
+	QFile file (filename);
+	if (!file.open (QFile::ReadOnly | QFile::Text)) {
+		QTextStream (stderr) << tr ("Error: unable to read session \"%1\"\n").arg (filename);
+		return false;
+	}
+	QTextStream stream (&file);
+	QString magic;
+	int version = 0;
+	QString content_hash;
+	stream >> magic >> version >> content_hash;
+	if (magic != "pdftalk-session" || version != session_format_version) {
+		QTextStream (stderr) << tr ("Error: not a session file \"%1\"\n").arg (filename);
+		return false;
+	}
+	if (content_hash != QString::fromLatin1 (document.content_hash ())) {
+		QTextStream (stderr) << tr ("Error: session \"%1\" was recorded on another document\n")
+		                            .arg (filename);
+		return false;
+	}
+	events.clear ();
+	while (true) {
+		qint64 time_ms = -1;
+		int page_index = -1;
+		int role = -1;
+		int cause = -1;
+		int width = 0;
+		int height = 0;
+		stream >> time_ms >> page_index >> role >> cause >> width >> height;
+		if (stream.status () != QTextStream::Ok) {
+			break; // End of file, or truncated last line
+		}
+		if (time_ms < 0 || page_index < 0 || page_index >= document.nb_pages () || role < 0 ||
+		    role >= static_cast<int> (ViewRole::Unknown) || cause < 0 ||
+		    cause >= static_cast<int> (RedrawCause::Unknown)) {
+			QTextStream (stderr) << tr ("Error: invalid event in session \"%1\"\n").arg (filename);
+			return false;
+		}
+		events.push_back (SessionEvent{time_ms, page_index, static_cast<ViewRole> (role),
+		                               static_cast<RedrawCause> (cause), QSize (width, height)});
+	}
+	return true;
+}
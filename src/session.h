@@ -0,0 +1,73 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QObject>
+#include <QSize>
+#include <QTextStream>
+
+#include "controller.h"
+class Document;
+namespace Render {
+class Request;
+}
+
+/* Navigation session log.
+ * Records the render requests of the views during a presentation, with their time.
+ * Requests contain both navigation (page changes) and view resizes (render sizes).
+ * A session can be replayed on the render system to compare strategies (see bench/).
+ *
+ * The file is a text file, with a header line then one line per request:
+ * "pdftalk-session <version> <document content hash>"
+ * "<time ms> <current page index> <role> <cause> <box width> <box height>"
+ * Role and cause are the integer values of the enums.
+ */
+struct SessionEvent {
+	qint64 time_ms; // From the start of the session
+	int current_page_index;
+	ViewRole role;
+	RedrawCause cause;
+	QSize box;
+};
+
+class SessionRecorder : public QObject {
+	Q_OBJECT
+
+private:
+	QFile file_;
+	QTextStream stream_;
+	QElapsedTimer clock_;
+
+public:
+	// Prints a message to stderr and returns nullptr on error
+	static SessionRecorder * open (const QString & filename, const Document & document,
+	                               QObject * parent);
+
+public slots:
+	void record_request (const Render::Request & request);
+
+private:
+	SessionRecorder (const QString & filename, QObject * parent);
+};
+
+// Returns false on error (with a message on stderr), or if the session is for another document
+bool read_session (const QString & filename, const Document & document,
+                   std::vector<SessionEvent> & events);
@@ -0,0 +1,147 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+
+#include "render_internal.h"
+
+namespace Render {
+
+Statistics::Statistics () {
+	clock_.start ();
+}
+
+void Statistics::request_started (const Info & render_info) {
+	pending_requests_.insert (render_info, clock_.nsecsElapsed () / 1000);
+}
+
+void Statistics::request (const Info & render_info, ViewRole role, Outcome outcome) {
+	auto it = requests_by_role_.find (role);
+	if (it == requests_by_role_.end ()) {
+		it = requests_by_role_.insert (role, std::array<int, nb_outcomes>{});
+	}
+	it.value ()[static_cast<int> (outcome)]++;
+	if (outcome == Outcome::Ignored) {
+		pending_requests_.remove (render_info);
+	}
+}
+
+void Statistics::request_served (const Info & render_info) {
+	auto it = pending_requests_.find (render_info);
+	if (it != pending_requests_.end ()) {
+		request_latencies_.append (clock_.nsecsElapsed () / 1000 - it.value ());
+		pending_requests_.erase (it);
+	}
+	prefetch_render_used (render_info);
+}
+
+void Statistics::prefetch_render_finished (const Info & render_info) {
+	prefetch_renders_++;
+	unused_prefetch_renders_.insert (render_info);
+}
+
+void Statistics::prefetch_render_used (const Info & render_info) {
+	if (unused_prefetch_renders_.remove (render_info)) {
+		prefetch_used_++;
+	}
+}
+
+void Statistics::prefetch_render_joined () {
+	prefetch_renders_++;
+	prefetch_used_++;
+}
+
+void Statistics::render_evicted (const Info & render_info) {
+	if (unused_prefetch_renders_.remove (render_info)) {
+		prefetch_evicted_++;
+	}
+}
+
+void Statistics::compressed_stored (const Compressed & compressed) {
+	uncompressed_bytes_ += qint64 (compressed.size.width ()) * compressed.size.height () * 4;
+	compressed_bytes_ += compressed.data.size ();
+	nb_compressed_++;
+	if (!compressed.reference.isNull ()) {
+		nb_delta_encoded_++;
+	}
+}
+
+void Statistics::print (QTextStream & out) const {
+	auto percent = [](qint64 part, qint64 total) {
+		return total > 0 ? QString::number (100. * part / total, 'f', 1) + '%' : QString ("-");
+	};
+
+	out << "Requests (hot / cached / running / rendered / ignored):\n";
+	for (auto it = requests_by_role_.begin (); it != requests_by_role_.end (); ++it) {
+		const auto & counts = it.value ();
+		int total = 0;
+		for (auto c : counts) {
+			total += c;
+		}
+		QString role_name;
+		QDebug (&role_name).noquote () << it.key ();
+		out << QString ("  %1: %2 requests, %3 / %4 / %5 / %6 / %7\n")
+		           .arg (role_name.trimmed ())
+		           .arg (total)
+		           .arg (counts[static_cast<int> (Outcome::Hot)])
+		           .arg (counts[static_cast<int> (Outcome::Cached)])
+		           .arg (counts[static_cast<int> (Outcome::Running)])
+		           .arg (counts[static_cast<int> (Outcome::Launched)])
+		           .arg (counts[static_cast<int> (Outcome::Ignored)]);
+		const int hits = counts[static_cast<int> (Outcome::Hot)] +
+		                 counts[static_cast<int> (Outcome::Cached)] +
+		                 counts[static_cast<int> (Outcome::Running)];
+		out << QString ("    hit ratio %1\n").arg (percent (hits, total));
+	}
+
+	out << QString ("Prefetch renders: %1, used %2 (%3), evicted unused %4 (%5)\n")
+	           .arg (prefetch_renders_)
+	           .arg (prefetch_used_)
+	           .arg (percent (prefetch_used_, prefetch_renders_))
+	           .arg (prefetch_evicted_)
+	           .arg (percent (prefetch_evicted_, prefetch_renders_));
+
+	// Latency percentiles, and histogram with power of 2 buckets (in ms)
+	auto latencies = request_latencies_;
+	std::sort (latencies.begin (), latencies.end ());
+	auto percentile = [&latencies](int p) {
+		auto index = std::min (latencies.size () - 1, latencies.size () * p / 100);
+		return QString::number (latencies[index] / 1000., 'f', 1);
+	};
+	out << QString ("Request latency: %1 requests").arg (latencies.size ());
+	if (!latencies.isEmpty ()) {
+		out << QString (", p50 %1ms, p90 %2ms, p99 %3ms, max %4ms")
+		           .arg (percentile (50), percentile (90), percentile (99))
+		           .arg (latencies.last () / 1000., 0, 'f', 1);
+	}
+	out << '\n';
+	auto bucket_begin = latencies.cbegin ();
+	for (qint64 bucket_end_ms = 1; bucket_begin != latencies.cend (); bucket_end_ms *= 2) {
+		auto bucket_end = std::lower_bound (bucket_begin, latencies.cend (), bucket_end_ms * 1000);
+		if (bucket_end != bucket_begin) {
+			out << QString ("  < %1ms: %2\n").arg (bucket_end_ms).arg (bucket_end - bucket_begin);
+		}
+		bucket_begin = bucket_end;
+	}
+
+	out << QString ("Compression: %1 renders, to %2 of 32 bit images, %3 delta encoded\n")
+	           .arg (nb_compressed_)
+	           .arg (percent (compressed_bytes_, uncompressed_bytes_))
+	           .arg (nb_delta_encoded_);
+	out.flush ();
+}
+
+} // namespace Render
@@ -0,0 +1,168 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QThread>
+
+#include "trace.h"
+
+namespace Trace {
+
+namespace {
+	struct Event {
+		const char * name;
+		qint64 start; // ns
+		qint64 duration; // ns, -1 for instant events
+		Args args;
+	};
+
+	/* Written by its thread only.
+	 * next is published with release semantics after writing the event.
+	 * The writer of the trace reads events below next, after disabling tracing.
+	 */
+	struct ThreadBuffer {
+		static constexpr quint64 capacity = 1 << 16;
+		int tid;
+		QString name;
+		std::vector<Event> events;
+		std::atomic<quint64> next{0};
+
+		ThreadBuffer (int id, const QString & thread_name)
+		    : tid (id), name (thread_name), events (capacity) {}
+	};
+
+	std::atomic<bool> enabled{false};
+	const auto clock_origin = std::chrono::steady_clock::now ();
+
+	QMutex registry_mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> registry; // Buffers outlive threads
+
+	thread_local ThreadBuffer * current_thread_buffer = nullptr;
+
+	ThreadBuffer & thread_buffer () {
+		if (current_thread_buffer == nullptr) {
+			auto * thread = QThread::currentThread ();
+			QString name = thread->objectName ();
+			if (QCoreApplication::instance () != nullptr &&
+			    thread == QCoreApplication::instance ()->thread ()) {
+				name = "GUI";
+			}
+			QMutexLocker lock (&registry_mutex);
+			const int tid = static_cast<int> (registry.size ()) + 1;
+			if (name.isEmpty ()) {
+				name = QString ("Thread %1").arg (tid);
+			}
+			registry.emplace_back (new ThreadBuffer (tid, name));
+			current_thread_buffer = registry.back ().get ();
+		}
+		return *current_thread_buffer;
+	}
+
+	void record (const Event & event) {
+		auto & buffer = thread_buffer ();
+		const auto index = buffer.next.load (std::memory_order_relaxed);
+		buffer.events[index % ThreadBuffer::capacity] = event;
+		buffer.next.store (index + 1, std::memory_order_release);
+	}
+
+	QString json_string (const QString & s) {
+		QString escaped = s;
+		escaped.replace ('\\', "\\\\").replace ('"', "\\\"");
+		return '"' + escaped + '"';
+	}
+} // namespace
+
+void enable () {
+	enabled.store (true);
+}
+bool is_enabled () {
+	return enabled.load (std::memory_order_relaxed);
+}
+
+qint64 now () {
+	using namespace std::chrono;
+	return duration_cast<nanoseconds> (steady_clock::now () - clock_origin).count ();
+}
+
+void instant (const char * name, const Args & args) {
+	if (is_enabled ()) {
+		record (Event{name, now (), -1, args});
+	}
+}
+void complete (const char * name, qint64 start, const Args & args) {
+	if (is_enabled ()) {
+		record (Event{name, start, now () - start, args});
+	}
+}
+
+bool write_json_file (const QString & filename) {
+	enabled.store (false);
+	QFile file (filename);
+	if (!file.open (QFile::WriteOnly | QFile::Truncate)) {
+		return false;
+	}
+	QTextStream out (&file);
+	auto microseconds = [](qint64 ns) {
+		return QString::number (static_cast<double> (ns) / 1000., 'f', 3);
+	};
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	auto separator = [&first]() -> const char * {
+		if (first) {
+			first = false;
+			return "";
+		}
+		return ",\n";
+	};
+
+	QMutexLocker lock (&registry_mutex);
+	for (const auto & buffer : registry) {
+		out << separator () << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+		    << buffer->tid << ",\"args\":{\"name\":" << json_string (buffer->name) << "}}";
+		const auto end = buffer->next.load (std::memory_order_acquire);
+		const auto begin = end > ThreadBuffer::capacity ? end - ThreadBuffer::capacity : 0;
+		for (auto i = begin; i < end; ++i) {
+			const auto & event = buffer->events[i % ThreadBuffer::capacity];
+			out << separator () << "{\"name\":" << json_string (event.name) << ",\"ph\":\""
+			    << (event.duration >= 0 ? 'X' : 'i') << "\",\"pid\":1,\"tid\":" << buffer->tid
+			    << ",\"ts\":" << microseconds (event.start);
+			if (event.duration >= 0) {
+				out << ",\"dur\":" << microseconds (event.duration);
+			} else {
+				out << ",\"s\":\"t\"";
+			}
+			if (event.args.page_index >= 0) {
+				out << ",\"args\":{\"page\":" << event.args.page_index
+				    << ",\"width\":" << event.args.width << ",\"height\":" << event.args.height << '}';
+			}
+			out << '}';
+		}
+	}
+	out << "\n]}\n";
+	out.flush ();
+	return file.error () == QFile::NoError;
+}
+
+} // namespace Trace
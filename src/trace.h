@@ -0,0 +1,79 @@
+/* PDFTalk - PDF presentation tool
+ * Copyright (C) 2016 - 2018 Francois Gindraud
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <QSize>
+#include <QString>
+
+/* Timeline tracing of the render system, to tune prefetching.
+ *
+ * Events are recorded in per thread ring buffers, without locks.
+ * A thread takes a lock once, to register its buffer on its first event.
+ * If a buffer is full, the oldest events of the thread are overwritten.
+ * When tracing is disabled (default), recording an event is a relaxed atomic load.
+ *
+ * The trace is written in the Chrome trace event JSON format.
+ * It can be viewed with chrome://tracing or https://ui.perfetto.dev.
+ * Event names must be string literals, as only the pointer is stored.
+ */
+namespace Trace {
+
+// Event arguments: render page index and size, or none (-1)
+struct Args {
+	int page_index;
+	int width;
+	int height;
+
+	Args () : Args (-1, QSize (-1, -1)) {}
+	Args (int page, const QSize & size)
+	    : page_index (page), width (size.width ()), height (size.height ()) {}
+};
+
+void enable ();
+bool is_enabled ();
+
+// Disables tracing, and writes events to a file. Returns false on error.
+bool write_json_file (const QString & filename);
+
+// Timestamp in ns, for complete ()
+qint64 now ();
+
+// Event without duration
+void instant (const char * name, const Args & args = Args ());
+// Event from start to now
+void complete (const char * name, qint64 start, const Args & args = Args ());
+
+// Event for the lifetime of the Scope object
+class Scope {
+private:
+	const char * name_;
+	Args args_;
+	qint64 start_;
+
+public:
+	explicit Scope (const char * name, const Args & args = Args ())
+	    : name_ (name), args_ (args), start_ (is_enabled () ? now () : -1) {}
+	~Scope () {
+		if (start_ >= 0) {
+			complete (name_, start_, args_);
+		}
+	}
+	Scope (const Scope &) = delete;
+	Scope & operator= (const Scope &) = delete;
+};
+
+} // namespace Trace
@@ -22,7 +22,9 @@
 #include <QSizePolicy>
 #include <QVBoxLayout>
 
+#include "action.h"
 #include "document.h"
+#include "trace.h"
 #include "views.h"
 
 // PageViewer
@@ -34,6 +36,11 @@ PageViewer::PageViewer (const ViewRole & role, QWidget * parent) : QLabel (paren
 	QSizePolicy policy{QSizePolicy::Expanding, QSizePolicy::Expanding};
 	policy.setHeightForWidth (true);
 	setSizePolicy (policy);
+	setMouseTracking (true); // For link hover
+
+	resize_timer_.setSingleShot (true);
+	resize_timer_.setInterval (resize_settle_ms);
+	connect (&resize_timer_, &QTimer::timeout, [this]() { update_label (RedrawCause::Resize); });
 }
 
 int PageViewer::heightForWidth (int w) const {
@@ -48,35 +55,76 @@ QSize PageViewer::sizeHint () const {
 }
 
 void PageViewer::resizeEvent (QResizeEvent *) {
-	update_label (RedrawCause::Resize);
+	if (current_render_.isNull ()) {
+		// Nothing shown yet (first layout): no need to wait
+		update_label (RedrawCause::Resize);
+		return;
+	}
+	// Show the last pixmap scaled until the size settles and the new render arrives
+	if (!received_pixmap_.isNull () && received_render_.page () == current_render_.page ()) {
+		auto scaled_size = Render::Info (current_render_.page (), size ()).size ();
+		if (!scaled_size.isEmpty ()) {
+			setPixmap (received_pixmap_.scaled (scaled_size, Qt::IgnoreAspectRatio,
+			                                    Qt::FastTransformation));
+		}
+	}
+	resize_timer_.start ();
 }
 void PageViewer::mouseReleaseEvent (QMouseEvent * event) {
-	if (event->button () == Qt::LeftButton && !size ().isEmpty () && !current_render_.isNull ()) {
-		// Determine pixmap position (centered)
-		auto label_size = size ();
-		auto pixmap_size = current_render_.size ();
-		auto pixmap_offset_in_label = (label_size - pixmap_size) / 2;
-		// Click position in pixmap
-		auto click_pos_01 =
-		    QPointF (static_cast<qreal> (event->x () - pixmap_offset_in_label.width ()) /
-		                 static_cast<qreal> (pixmap_size.width ()),
-		             static_cast<qreal> (event->y () - pixmap_offset_in_label.height ()) /
-		                 static_cast<qreal> (pixmap_size.height ()));
-		auto * action = current_render_.page ()->on_click (click_pos_01);
+	if (event->button () == Qt::LeftButton) {
+		auto * action = action_at (event->pos ());
 		if (action != nullptr)
 			emit action_activated (action);
 	}
 }
 
+void PageViewer::mouseMoveEvent (QMouseEvent * event) {
+	auto * action = action_at (event->pos ());
+	if (action == hovered_action_)
+		return;
+	hovered_action_ = action;
+	if (action != nullptr && current_page_ != nullptr) {
+		auto target_index = action->target_page_index (*current_page_);
+		if (target_index >= 0)
+			emit link_target_hovered (current_page_->document ().page (target_index));
+	}
+}
+
+const Action::Base * PageViewer::action_at (const QPoint & pos) const {
+	if (size ().isEmpty () || current_render_.isNull ())
+		return nullptr;
+	// Determine pixmap position (centered)
+	auto label_size = size ();
+	auto pixmap_size = current_render_.size ();
+	auto pixmap_offset_in_label = (label_size - pixmap_size) / 2;
+	// Position in pixmap
+	auto pos_01 = QPointF (static_cast<qreal> (pos.x () - pixmap_offset_in_label.width ()) /
+	                           static_cast<qreal> (pixmap_size.width ()),
+	                       static_cast<qreal> (pos.y () - pixmap_offset_in_label.height ()) /
+	                           static_cast<qreal> (pixmap_size.height ()));
+	return current_render_.page ()->on_click (pos_01);
+}
+
 void PageViewer::change_current_page (const PageInfo * new_current_page, RedrawCause cause) {
 	current_page_ = new_current_page;
+	hovered_action_ = nullptr;
+	resize_timer_.stop (); // The request will use the current size
 	update_label (cause);
 }
 void PageViewer::receive_pixmap (const Render::Info & render_info, QPixmap pixmap) {
-	// Filter to only use the requested pixmaps
+	// Filter to only use the requested pixmaps. Drafts are shown until the full render arrives.
+	if (requested_a_pixmap_ && render_info.quality () == Render::Quality::Draft &&
+	    render_info.with_quality (Render::Quality::Full) == current_render_) {
+		setPixmap (pixmap);
+		return;
+	}
 	if (requested_a_pixmap_ && render_info == current_render_) {
 		requested_a_pixmap_ = false;
+		Trace::Scope trace ("set_pixmap",
+		                    Trace::Args (render_info.page ()->index (), render_info.size ()));
 		setPixmap (pixmap);
+		received_render_ = render_info;
+		received_pixmap_ = pixmap;
 	}
 }
 
@@ -84,8 +132,10 @@ void PageViewer::update_label (RedrawCause cause) {
 	auto request = Render::Request{current_page_, size (), role_, cause};
 	auto new_render = request.requested_render ();
 	if (new_render != current_render_) {
+		if (new_render.page () != received_render_.page ()) {
+			clear (); // Remove old pixmap, unless it is the same page at another size
+		}
 		current_render_ = new_render;
-		clear (); // Remove old pixmap
 		if (!current_render_.isNull ()) {
 			requested_a_pixmap_ = true;
 			emit request_render (request);
@@ -18,6 +18,7 @@
 
 #include <QLabel>
 #include <QPixmap>
+#include <QTimer>
 #include <QWidget>
 
 #include "controller.h"
@@ -41,7 +42,12 @@ class Base;
  * Requests for Pixmaps will go through the Rendering system.
  * The rendering system will broadcast request answers: receive_pixmap must filter incoming pixmaps.
  *
+ * Resizes are coalesced: the render is requested when the size has not changed for
+ * resize_settle_ms, which also supersedes renders at intermediate sizes.
+ * Meanwhile the last received pixmap of the page is shown, scaled to the new size.
+ *
  * This widget also catches click events and will activate the page actions accordingly.
+ * Hovering a navigation action announces its target page (link_target_hovered), to prefetch it.
  */
 class PageViewer : public QLabel {
 	Q_OBJECT
@@ -51,6 +57,12 @@ private:
 	const PageInfo * current_page_{nullptr}; // Current page of presentation
 	Render::Info current_render_{};          // Current rendered page (requested or shown).
 	bool requested_a_pixmap_{false};         // Did we request a render ?
+	const Action::Base * hovered_action_{nullptr};
+
+	static constexpr int resize_settle_ms = 100;
+	QTimer resize_timer_;
+	Render::Info received_render_{}; // Last received pixmap, to show scaled while resizing
+	QPixmap received_pixmap_{};
 
 public:
 	explicit PageViewer (const ViewRole & role, QWidget * parent = nullptr);
@@ -61,9 +73,11 @@ public:
 
 	void resizeEvent (QResizeEvent *) Q_DECL_FINAL;
 	void mouseReleaseEvent (QMouseEvent * event) Q_DECL_FINAL;
+	void mouseMoveEvent (QMouseEvent * event) Q_DECL_FINAL;
 
 signals:
 	void action_activated (const Action::Base * action);
+	void link_target_hovered (const PageInfo * target_page);
 	void request_render (Render::Request request);
 
 public slots:
@@ -72,6 +86,7 @@ public slots:
 
 private:
 	void update_label (RedrawCause cause);
+	const Action::Base * action_at (const QPoint & pos) const;
 };
 
 // Just one PageViewer, but also set a black background.